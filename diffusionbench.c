@@ -0,0 +1,309 @@
+/*benchmark for the diffusion kernels. For every grid size, solver and
+  thread count it times the set up (labelling, buffers, thread pool), the
+  boundary (putting the fixed layers back) and the update kernel on their
+  own, and writes one line per run as CSV (default) or JSON so results can
+  be kept and compared between commits. e.g.
+
+    ./diffusionbench > bench.csv
+    ./diffusionbench --json --sizes 50,100 --modes stencil,adi --threads 1,4
+
+  bytesPerCell is how much memory a kernel has to move per cell updated
+  (reads plus writes of whole grids, counting each neighbour read as a
+  cache hit), so bandwidth = cellUpdatesPerSec*bytesPerCell.
+*/
+#include "diffusioncore.h"
+
+#include <chrono>
+#include <string>
+
+using std::cout;
+using std::endl;
+
+enum EBenchMode { kBenchStencil=0, kBenchADI=1, kBenchMultinomial=2, kBenchFront=3,
+                  kBenchTiled=4, kBenchFloat=5 };
+static const char *kBenchModeNames[] = {"stencil", "adi", "multinomial", "front", "tiled",
+                                        "float"};
+const int kBenchModes = 6;
+const int kBenchTileSteps = 4; //steps per pass for tiled
+const double kBenchFrontThreshold = 1e-9; //of maxConc, for front
+
+//grid bytes read + written per cell updated, see each kernel:
+//stencil reads cur and writes next; ADI writes delta, sweeps it forwards
+//and backwards in y and z, then reads conc and delta and writes conc;
+//the walk zeroes next, reads cur and adds into next. front is the stencil
+//with ActiveFront, counted as if it did every cell, so its rate is how
+//much faster it gets through the whole grid (liveFraction is the share of
+//the acrylic it did update, averaged over the timed steps); likewise tiled, which only
+//goes to memory once every kBenchTileSteps steps. float is the stencil on
+//a float grid.
+static const double kBytesPerCell[] = {16, 112, 32, 16, 16, 8};
+
+struct BenchGrid { int nx, ny, nz; };
+
+struct BenchResult {
+ int mode;
+ BenchGrid grid;
+ int threads;
+ int steps;
+ double setupSec, boundarySec, kernelSec; //boundary and kernel per step
+ double speedup; //kernel time with 1 thread over this one, 0 if no 1 thread run
+ double liveFraction; //share of the acrylic updated per step, 1 but for front
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+ return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+//cells each kernel updates per step: the acrylic for the grid solvers,
+//everything off the outer face for the walk
+static long updatedCells(int mode, const BenchGrid &g)
+{
+ if (mode==kBenchMultinomial) return (long)(g.nx-2)*(g.ny-2)*(g.nz-2);
+ return (long)(g.nx-4)*(g.ny-4)*(g.nz-4);
+}
+
+/*times one solver on one grid with one n.o. threads. Steps are repeated
+  until minTime seconds of kernel time, so small grids aren't all timer
+  noise.
+ function name: benchOne
+ param1: EBenchMode
+ param2: grid size
+ param3: n.o. threads
+ param4: least kernel time to measure over, seconds
+ output: the timings
+*/
+static BenchResult benchOne(int mode, const BenchGrid &g, int threads, double minTime)
+{
+ //the dt and concs a real run with the default config would have
+ DiffusionConfig config;
+ config.solverMode = mode==kBenchADI ? kImplicitADI :
+                     mode==kBenchMultinomial ? kMultinomialWalk : kExplicitStencil;
+ config.nx = g.nx; config.ny = g.ny; config.nz = g.nz;
+ const double xLen = config.xTotLen/g.nx, yLen = config.yTotLen/g.ny, zLen = config.zTotLen/g.nz;
+ const double maxConc = waterLayerConc(config);
+ const double elemVol = xLen*yLen*zLen;
+ BenchResult res;
+ res.mode = mode;
+ res.grid = g;
+ res.threads = threads;
+ res.speedup = 0;
+
+ std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+ const long cells = (long)g.nx*g.ny*g.nz;
+ std::vector<unsigned char> elemLabel(cells);
+ std::vector<long> outerElems, waterElems;
+ labelElems(&elemLabel[0], g.nx, g.ny, g.nz, outerElems, waterElems);
+ std::vector<double> concCur(cells), concNext(cells), adiWork(2*(g.nx+g.ny+g.nz));
+ std::vector<long long> grpCur, grpNext;
+ std::vector<float> floatCur, floatNext;
+ const long long holderGrp = llround(config.holderConc*elemVol*config.fakeAvoNum);
+ const long long waterGrp = llround(maxConc*elemVol*config.fakeAvoNum);
+ if (mode==kBenchMultinomial) {
+  grpCur.assign(cells, 0LL);
+  grpNext.assign(cells, 0LL);
+  applyFixedElems(&grpCur[0], outerElems, holderGrp);
+  applyFixedElems(&grpCur[0], waterElems, waterGrp);
+ }
+ else {
+  stencilInit(&concCur[0], cells, outerElems, waterElems, config.holderConc, maxConc);
+  stencilInit(&concNext[0], cells, outerElems, waterElems, config.holderConc, maxConc);
+ }
+ if (mode==kBenchFloat) {
+  floatCur.assign(concCur.begin(), concCur.end());
+  floatNext.assign(concNext.begin(), concNext.end());
+ }
+ SlabPool pool(threads);
+ const NeighbourMoves<27> moves(g.nx, g.ny);
+ ActiveFront front(g.nx, g.ny, g.nz, kBenchFrontThreshold*maxConc);
+ res.setupSec = secondsSince(start);
+
+ const double D = config.dCoeff;
+ //the walk doesn't use it
+ const double dt = gridTimestep(config, D, xLen, yLen, zLen, false);
+ const int callSteps = mode==kBenchTiled ? kBenchTileSteps : 1;
+ const double rx = D*dt/(xLen*xLen), ry = D*dt/(yLen*yLen), rz = D*dt/(zLen*zLen);
+
+ //one untimed step to fault the pages in and start the threads
+ int steps = 0;
+ double kernelTime = 0, boundaryTime = 0, liveSum = 0;
+ for (int warm=1; ; warm=0) {
+  start = std::chrono::steady_clock::now();
+  if (mode==kBenchStencil) {
+   stencilStep(&concCur[0], &concNext[0], g.nx, g.ny, g.nz, rx, ry, rz, pool);
+   concCur.swap(concNext);
+  }
+  else if (mode==kBenchTiled) {
+   stencilStepsTiled(&concCur[0], &concNext[0], g.nx, g.ny, g.nz, rx, ry, rz, callSteps, pool);
+   concCur.swap(concNext);
+  }
+  else if (mode==kBenchFloat) {
+   stencilStep(&floatCur[0], &floatNext[0], g.nx, g.ny, g.nz, rx, ry, rz, pool);
+   floatCur.swap(floatNext);
+  }
+  else if (mode==kBenchFront) {
+   if (!warm) liveSum += (double)front.liveElems()/updatedCells(mode, g);
+   stencilStepActive(&concCur[0], &concNext[0], g.nx, g.ny, g.nz, rx, ry, rz, front, pool);
+   concCur.swap(concNext);
+  }
+  else if (mode==kBenchADI) {
+   adiStep(&concCur[0], &concNext[0], g.nx, g.ny, g.nz, rx, ry, rz, 0.5, &adiWork[0], pool);
+  }
+  else {
+   multinomialStep(&grpCur[0], &grpNext[0], g.nx, g.ny, g.nz, moves, config.walkSeed,
+                   steps+1, pool);
+  }
+  const double kernelStep = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  if (mode==kBenchMultinomial) {
+   applyFixedElems(&grpNext[0], outerElems, holderGrp);
+   applyFixedElems(&grpNext[0], waterElems, waterGrp);
+   grpCur.swap(grpNext);
+  }
+  else if (mode==kBenchFloat) {
+   applyFixedElems(&floatCur[0], outerElems, (float)config.holderConc);
+   applyFixedElems(&floatCur[0], waterElems, (float)maxConc);
+  }
+  else {
+   //the grid solvers only need this once, but time what it would cost
+   applyFixedElems(&concCur[0], outerElems, config.holderConc);
+   applyFixedElems(&concCur[0], waterElems, maxConc);
+  }
+  const double boundaryStep = secondsSince(start);
+  if (warm) continue;
+
+  kernelTime += kernelStep;
+  boundaryTime += boundaryStep;
+  steps += callSteps;
+  if (kernelTime>=minTime && steps>=3) break;
+ }
+ res.steps = steps;
+ res.kernelSec = kernelTime/steps;
+ res.boundarySec = boundaryTime/steps;
+ res.liveFraction = mode==kBenchFront ? liveSum/steps : 1;
+ return res;
+}
+
+//comma separated list of ints, e.g. "1,2,4"
+static std::vector<int> parseInts(const char *list)
+{
+ std::vector<int> vals;
+ for (const char *p=list; *p; ) {
+  char *end;
+  long v = strtol(p, &end, 10);
+  if (end==p) break;
+  vals.push_back((int)v);
+  p = *end==',' ? end+1 : end;
+ }
+ return vals;
+}
+
+static void printResult(const BenchResult &r, bool json, bool first)
+{
+ const long updated = updatedCells(r.mode, r.grid);
+ const double rate = updated/r.kernelSec;
+ if (json) {
+  printf("%s  {\"mode\": \"%s\", \"nx\": %d, \"ny\": %d, \"nz\": %d, \"cells\": %ld, "
+         "\"threads\": %d, \"steps\": %d, \"setupSec\": %.6g, \"boundarySecPerStep\": %.6g, "
+         "\"kernelSecPerStep\": %.6g, \"cellUpdatesPerSec\": %.6g, \"bytesPerCell\": %g, "
+         "\"gbPerSec\": %.4g, \"speedup\": %.3f, \"liveFraction\": %.3f}",
+         first ? "" : ",\n", kBenchModeNames[r.mode], r.grid.nx, r.grid.ny, r.grid.nz,
+         (long)r.grid.nx*r.grid.ny*r.grid.nz, r.threads, r.steps, r.setupSec, r.boundarySec,
+         r.kernelSec, rate, kBytesPerCell[r.mode], rate*kBytesPerCell[r.mode]*1e-9, r.speedup,
+         r.liveFraction);
+ }
+ else {
+  printf("%s,%d,%d,%d,%ld,%d,%d,%.6g,%.6g,%.6g,%.6g,%g,%.4g,%.3f,%.3f\n",
+         kBenchModeNames[r.mode], r.grid.nx, r.grid.ny, r.grid.nz,
+         (long)r.grid.nx*r.grid.ny*r.grid.nz, r.threads, r.steps, r.setupSec, r.boundarySec,
+         r.kernelSec, rate, kBytesPerCell[r.mode], rate*kBytesPerCell[r.mode]*1e-9, r.speedup,
+         r.liveFraction);
+ }
+ fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+ cout << "usage: " << prog << " [options]\n"
+      << " --sizes N,N,..    cube grids to run (5,10,50,100,200)\n"
+      << " --grids XxYxZ,..  other grids, default 64x32x256,200x40x20,256x256x64\n"
+      << " --modes M,..      stencil, adi, multinomial, front, tiled, float (all)\n"
+      << " --threads N,..    thread counts (1,2,4,.. up to one per core)\n"
+      << " --min-time S      least kernel time per run in seconds (0.2)\n"
+      << " --json            JSON instead of CSV" << endl;
+}
+
+int main(int argc, char **argv)
+{
+ std::vector<int> sizes = parseInts("5,10,50,100,200");
+ std::vector<BenchGrid> grids;
+ //256x256x64 is wide enough along x and y for front to skip tiles
+ std::string gridList = "64x32x256,200x40x20,256x256x64";
+ std::vector<int> modes;
+ std::vector<int> threadCounts;
+ double minTime = 0.2;
+ bool json = false;
+
+ for (int a=1; a<argc; a++) {
+  const bool hasVal = a+1<argc;
+  if (strcmp(argv[a], "--sizes")==0 && hasVal) sizes = parseInts(argv[++a]);
+  else if (strcmp(argv[a], "--grids")==0 && hasVal) gridList = argv[++a];
+  else if (strcmp(argv[a], "--modes")==0 && hasVal) {
+   std::string list = argv[++a];
+   for (int m=0; m<kBenchModes; m++) {
+    if (list.find(kBenchModeNames[m])!=std::string::npos) modes.push_back(m);
+   }
+  }
+  else if (strcmp(argv[a], "--threads")==0 && hasVal) threadCounts = parseInts(argv[++a]);
+  else if (strcmp(argv[a], "--min-time")==0 && hasVal) minTime = atof(argv[++a]);
+  else if (strcmp(argv[a], "--json")==0) json = true;
+  else {
+   usage(argv[0]);
+   return strcmp(argv[a], "--help")==0 ? 0 : 1;
+  }
+ }
+
+ for (size_t q=0; q<sizes.size(); q++) {
+  BenchGrid g = {sizes[q], sizes[q], sizes[q]};
+  grids.push_back(g);
+ }
+ for (const char *p=gridList.c_str(); *p; ) {
+  BenchGrid g;
+  int used = 0;
+  if (sscanf(p, "%dx%dx%d%n", &g.nx, &g.ny, &g.nz, &used)!=3) break;
+  grids.push_back(g);
+  p += used;
+  if (*p==',') p++;
+ }
+ if (modes.empty()) for (int m=0; m<kBenchModes; m++) modes.push_back(m);
+ if (threadCounts.empty()) {
+  const int cores = std::max(1, (int)std::thread::hardware_concurrency());
+  for (int t=1; t<cores; t*=2) threadCounts.push_back(t);
+  threadCounts.push_back(cores);
+ }
+
+ if (json) printf("[\n");
+ else printf("mode,nx,ny,nz,cells,threads,steps,setupSec,boundarySecPerStep,kernelSecPerStep,"
+             "cellUpdatesPerSec,bytesPerCell,gbPerSec,speedup,liveFraction\n");
+ bool first = true;
+ for (size_t q=0; q<grids.size(); q++) {
+  if (grids[q].nx<5 || grids[q].ny<5 || grids[q].nz<5) {
+   std::cerr << "skipping " << grids[q].nx << "x" << grids[q].ny << "x" << grids[q].nz
+             << ", need at least 5 divisions along each axis" << endl;
+   continue;
+  }
+  for (size_t m=0; m<modes.size(); m++) {
+   double oneThread = 0;
+   for (size_t t=0; t<threadCounts.size(); t++) {
+    BenchResult r = benchOne(modes[m], grids[q], threadCounts[t], minTime);
+    if (threadCounts[t]==1) oneThread = r.kernelSec;
+    if (oneThread>0) r.speedup = oneThread/r.kernelSec;
+    printResult(r, json, first);
+    first = false;
+   }
+  }
+ }
+ if (json) printf("\n]\n");
+ return 0;
+}
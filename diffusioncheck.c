@@ -0,0 +1,166 @@
+/*checks that the solvers agree with each other where they should, on
+  small grids so it runs in a few seconds. make check runs it; it prints
+  one line per check and exits 1 if any of them fail.
+
+    ./diffusioncheck
+
+  Runs that should be the same to the bit are allowed no difference at
+  all; the rest are allowed what their check says.
+*/
+#include "diffusioncore.h"
+
+#include <sstream>
+
+using std::cout;
+using std::endl;
+
+static int nFailed = 0;
+
+//runs config with its printouts thrown away. The final concs go in conc.
+static bool runQuietly(const DiffusionConfig &config, std::vector<double> &conc)
+{
+ std::ostringstream sink;
+ std::streambuf *screen = cout.rdbuf(sink.rdbuf());
+ const int status = runDiffusion(config, &conc);
+ cout.rdbuf(screen);
+ return status==0 && (long)conc.size()==(long)config.nx*config.ny*config.nz;
+}
+
+//biggest |a-b| over the acrylic as a fraction of the water layer conc,
+//or -1 if either run failed
+static double biggestDifference(const DiffusionConfig &configA, const DiffusionConfig &configB)
+{
+ std::vector<double> a, b;
+ if (!runQuietly(configA, a) || !runQuietly(configB, b)) return -1;
+ std::vector<unsigned char> elemLabel(a.size());
+ std::vector<long> outerElems, waterElems;
+ labelElems(&elemLabel[0], configA.nx, configA.ny, configA.nz, outerElems, waterElems);
+ double biggest = 0;
+ for (size_t e=0; e<a.size(); e++) {
+  if (elemLabel[e]==kAcrylic) biggest = std::max(biggest, fabs(a[e]-b[e]));
+ }
+ return biggest/waterLayerConc(configA);
+}
+
+static void report(const char *name, double difference, double tolerance)
+{
+ const bool ok = difference>=0 && difference<=tolerance;
+ if (!ok) nFailed++;
+ cout << (ok ? "ok   " : "FAIL ") << name << ": difference " << difference
+      << " of max conc (allowed " << tolerance << ")" << endl;
+}
+
+//a small grid, odd and uneven so nothing lines up by chance
+static DiffusionConfig smallGrid(int solverMode)
+{
+ DiffusionConfig config;
+ config.solverMode = solverMode;
+ config.nx = 15; config.ny = 11; config.nz = 18;
+ config.totTime = 60;
+ config.nThreads = 1;
+ config.walkNeighbours = 19;
+ config.fakeAvoNum = 1e9;
+ return config;
+}
+
+//the slabs are shared out over threads but each elem's update doesn't
+//depend on which thread does it, walks' random numbers included
+static void checkThreads()
+{
+ const int modes[] = {kExplicitStencil, kImplicitADI, kMultinomialWalk};
+ const char *names[] = {"stencil on 3 threads", "adi on 3 threads", "multinomial on 3 threads"};
+ for (int q=0; q<3; q++) {
+  DiffusionConfig one = smallGrid(modes[q]), three = one;
+  three.nThreads = 3;
+  report(names[q], biggestDifference(one, three), 0);
+ }
+}
+
+//several steps per pass over the grid, on one thread and on several
+static void checkTiled()
+{
+ DiffusionConfig plain = smallGrid(kExplicitStencil), tiled = plain;
+ plain.tileSteps = 1;
+ tiled.tileSteps = 4;
+ report("tiled stencil", biggestDifference(plain, tiled), 0);
+ tiled.nThreads = 3;
+ report("tiled stencil on 3 threads", biggestDifference(plain, tiled), 0);
+}
+
+//at a threshold nothing's under, every tile is live and the front has to
+//do just what the whole grid does
+static void checkFront()
+{
+ DiffusionConfig plain = smallGrid(kExplicitStencil), front = plain;
+ plain.tileSteps = 1;
+ front.tileSteps = 1;
+ front.frontThreshold = 1e-300;
+ report("active front", biggestDifference(plain, front), 0);
+}
+
+//run straight through, and to halfway with a checkpoint then resumed
+static void checkResume(const char *name, int solverMode)
+{
+ const char *file = "diffusioncheck_checkpoint.dat";
+ DiffusionConfig straight = smallGrid(solverMode);
+ //the molecule walk moves every group, so give it fewer of them
+ if (solverMode==kRandomWalk) straight.fakeAvoNum = 1e6;
+ DiffusionConfig firstHalf = straight;
+ firstHalf.totTime = straight.totTime/2;
+ firstHalf.checkpointEvery = firstHalf.totTime;
+ firstHalf.checkpointFile = file;
+ DiffusionConfig resumed = straight;
+ resumed.resumeFile = file;
+ std::vector<double> unused;
+ double difference = -1;
+ if (runQuietly(firstHalf, unused)) difference = biggestDifference(straight, resumed);
+ remove(file);
+ remove(checkpointSeriesFile(file).c_str());
+ report(name, difference, 0);
+}
+
+static void checkResumes()
+{
+ checkResume("stencil resumed", kExplicitStencil);
+ checkResume("adi resumed", kImplicitADI);
+ checkResume("multinomial resumed", kMultinomialWalk);
+ checkResume("molecule walk resumed", kRandomWalk);
+}
+
+//floats only for storage, every update still in double
+static void checkFloat()
+{
+ DiffusionConfig plain = smallGrid(kExplicitStencil), floats = plain;
+ floats.floatStorage = true;
+ report("float storage", biggestDifference(plain, floats), 1e-5);
+}
+
+//with no temperature schedule and no conc dependence D is the same
+//everywhere, so it's the stencil worked out a different way
+static void checkVariable()
+{
+ report("variable stencil, constant D",
+        biggestDifference(smallGrid(kExplicitStencil), smallGrid(kVariableStencil)), 1e-12);
+}
+
+//the stencil is second order, so on this grid it's about 0.5% off the series
+static void checkSeries()
+{
+ DiffusionConfig series = smallGrid(kAnalytic);
+ series.analyticGridLengths = true;
+ report("series against the stencil", biggestDifference(series, smallGrid(kExplicitStencil)), 0.01);
+}
+
+int main()
+{
+ checkThreads();
+ checkTiled();
+ checkFront();
+ checkResumes();
+ checkFloat();
+ checkVariable();
+ checkSeries();
+
+ cout << (nFailed ? "some checks failed" : "all checks passed") << endl;
+ return nFailed ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+/*command line driver for the SNO+ 3D diffusion model, no ROOT needed.
+  Every setting in DiffusionConfig can be given as an option, so runs
+  don't need the macro edited and recompiled. e.g.
+
+    ./diffusioncli --mode adi --divs 40 --steps 500 --dt 7200
+    ./diffusioncli --mode breakthrough --nx 20 --ny 60 --nz 10 --frac 0.1
+    ./diffusioncli --sweep scenarios.csv --out results.csv
+
+  --help lists the options and their defaults.
+*/
+#include "diffusioncore.h"
+
+#include <getopt.h>
+
+using std::cout;
+using std::endl;
+
+//names for --mode and --source-face, in ESolverMode and EFace order
+static const char *kModeNames[] = {"walk", "stencil", "adi", "multinomial", "breakthrough",
+                                   "analytic", "variable"};
+static const char *kFaceNames[] = {"x-", "x+", "y-", "y+", "z-", "z+"};
+
+//index of name in names, or -1
+static int lookUp(const char *name, const char *const *names, int nNames)
+{
+ for (int q=0; q<nNames; q++) if (strcmp(name, names[q])==0) return q;
+ return -1;
+}
+
+static void usage(const char *prog, const DiffusionConfig &def)
+{
+ cout << "usage: " << prog << " [options]\n"
+      << " --mode M          walk, stencil, adi, multinomial, breakthrough, analytic or\n"
+      << "                   variable (walk)\n"
+      << " --divs N          N divisions along every axis (" << def.nx << ")\n"
+      << " --nx/--ny/--nz N  divisions along one axis, at least 5\n"
+      << " --steps N         n.o. timesteps (" << def.totTime << ")\n"
+      << " --dt S            seconds per step for the grid solvers, 0 for the default\n"
+      << " --length X,Y,Z    size of the piece in metres (" << def.xTotLen << ","
+      << def.yTotLen << "," << def.zTotLen << ")\n"
+      << " --D D             diffusion constant in m^2/s (" << def.dCoeff << ")\n"
+      << " --max-conc C      water layer conc, 0 for 2% of the acrylic's mass\n"
+      << " --holder-conc C   outer layer conc (" << def.holderConc << ")\n"
+      << " --neighbours N    moves for the walks, 7, 19 or 27 (" << def.walkNeighbours << ")\n"
+      << " --seed N          seed for the walks (" << def.walkSeed << ")\n"
+      << " --groups N        leader molecules per mole for the walks (" << def.fakeAvoNum << ")\n"
+      << " --threads N       0 for one per core (" << def.nThreads << ")\n"
+      << " --tile-steps N    stencil: steps per pass over the grid, 0 for auto ("
+      << def.tileSteps << "),\n"
+      << "                   which is 1 with --front-threshold\n"
+      << " --front-threshold F  stencil: skip tiles under F*max conc, 0 for never ("
+      << def.frontThreshold << "),\n"
+      << "                   one step at a time, so not with --tile-steps over 1\n"
+      << " --float           stencil: keep the grid in floats, half the memory\n"
+      << " --compare-double  stencil: with --float, say how far off it is from doubles\n"
+      << " --source-face F   breakthrough: wet face, x- x+ y- y+ z- z+ (y-)\n"
+      << " --frac F          breakthrough: threshold as a fraction of max conc (" << def.breakthroughFrac << ")\n"
+      << " --use-max         breakthrough: use the max conc on the far face, not the mean\n"
+      << " --dry-faces       breakthrough: other faces at conc 0 instead of sealed\n"
+      << " --max-time S      breakthrough: give up after S seconds (" << def.breakthroughMaxTime << ")\n"
+      << " --fixed-dt        breakthrough: don't adapt the timestep\n"
+      << " --grid-lengths    analytic: the box between the water layers, as the grids see it\n"
+      << " --validate M      analytic: run mode M instead and compare it with the series\n"
+      << " --temperatures F  variable: temperature schedule, time,kelvin lines\n"
+      << " --Ea E            variable: activation energy in J/mol (" << def.activationEnergy << ")\n"
+      << " --ref-temp T      variable: temperature --D is for, in kelvin (" << def.refTemperature << ")\n"
+      << " --conc-coeff B    variable: D goes as exp(B*conc/saturated conc) (" << def.concCoeff << ")\n"
+      << " --history N       latest steps kept in memory (" << def.historySteps << ")\n"
+      << " --snapshot-every N  write a snapshot every N steps, 0 for never\n"
+      << " --snapshot-file F   (" << def.snapshotFile << ")\n"
+      << " --observables F   grid solvers: write the uptake per step to csv file F\n"
+      << " --checkpoint-every N  save the whole run every N steps, 0 for never\n"
+      << " --checkpoint-file F   (" << def.checkpointFile << ")\n"
+      << " --resume F        carry on the run saved in checkpoint F\n"
+      << " --start-from F    new phase from the concs in checkpoint F\n"
+      << " --dry             out in dry air: outer layers at conc 0, D from --D-air\n"
+      << " --D-air D         D of saturated acrylic in dry air, 0 for --D\n"
+      << " --sweep F         run every scenario in table F instead (see readSweepScenarios)\n"
+      << " --out F           sweep results file (sweep_results.csv)\n"
+      << " --output-every N  sweep: write every N steps, 0 for 50 lines per scenario" << endl;
+}
+
+int main(int argc, char **argv)
+{
+ DiffusionConfig config;
+ const DiffusionConfig def;
+ enum { kOptNx=256, kOptNy, kOptNz, kOptMaxConc, kOptHolderConc, kOptNeighbours,
+        kOptGroups, kOptSourceFace, kOptUseMax, kOptDryFaces, kOptMaxTime, kOptFixedDt,
+        kOptHistory, kOptSnapshotEvery, kOptSnapshotFile, kOptSweep, kOptOut,
+        kOptOutputEvery, kOptFrontThreshold, kOptTileSteps, kOptObservables,
+        kOptCheckpointEvery, kOptCheckpointFile, kOptResume, kOptStartFrom, kOptDry,
+        kOptDAir, kOptFloat, kOptCompareDouble, kOptGridLengths, kOptValidate,
+        kOptTemperatures, kOptEa, kOptRefTemp, kOptConcCoeff };
+ static const struct option longOpts[] = {
+  {"mode", required_argument, 0, 'm'},
+  {"divs", required_argument, 0, 'n'},
+  {"nx", required_argument, 0, kOptNx},
+  {"ny", required_argument, 0, kOptNy},
+  {"nz", required_argument, 0, kOptNz},
+  {"steps", required_argument, 0, 's'},
+  {"dt", required_argument, 0, 't'},
+  {"length", required_argument, 0, 'l'},
+  {"D", required_argument, 0, 'D'},
+  {"max-conc", required_argument, 0, kOptMaxConc},
+  {"holder-conc", required_argument, 0, kOptHolderConc},
+  {"neighbours", required_argument, 0, kOptNeighbours},
+  {"seed", required_argument, 0, 'S'},
+  {"groups", required_argument, 0, kOptGroups},
+  {"threads", required_argument, 0, 'j'},
+  {"front-threshold", required_argument, 0, kOptFrontThreshold},
+  {"tile-steps", required_argument, 0, kOptTileSteps},
+  {"float", no_argument, 0, kOptFloat},
+  {"compare-double", no_argument, 0, kOptCompareDouble},
+  {"source-face", required_argument, 0, kOptSourceFace},
+  {"frac", required_argument, 0, 'f'},
+  {"use-max", no_argument, 0, kOptUseMax},
+  {"dry-faces", no_argument, 0, kOptDryFaces},
+  {"max-time", required_argument, 0, kOptMaxTime},
+  {"fixed-dt", no_argument, 0, kOptFixedDt},
+  {"grid-lengths", no_argument, 0, kOptGridLengths},
+  {"validate", required_argument, 0, kOptValidate},
+  {"temperatures", required_argument, 0, kOptTemperatures},
+  {"Ea", required_argument, 0, kOptEa},
+  {"ref-temp", required_argument, 0, kOptRefTemp},
+  {"conc-coeff", required_argument, 0, kOptConcCoeff},
+  {"history", required_argument, 0, kOptHistory},
+  {"snapshot-every", required_argument, 0, kOptSnapshotEvery},
+  {"snapshot-file", required_argument, 0, kOptSnapshotFile},
+  {"observables", required_argument, 0, kOptObservables},
+  {"checkpoint-every", required_argument, 0, kOptCheckpointEvery},
+  {"checkpoint-file", required_argument, 0, kOptCheckpointFile},
+  {"resume", required_argument, 0, kOptResume},
+  {"start-from", required_argument, 0, kOptStartFrom},
+  {"dry", no_argument, 0, kOptDry},
+  {"D-air", required_argument, 0, kOptDAir},
+  {"sweep", required_argument, 0, kOptSweep},
+  {"out", required_argument, 0, kOptOut},
+  {"output-every", required_argument, 0, kOptOutputEvery},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+ };
+
+ const char *sweepFile = 0, *sweepOut = "sweep_results.csv";
+ int outputEvery = 0;
+ int opt;
+ while ((opt = getopt_long(argc, argv, "m:n:s:t:l:D:S:j:f:h", longOpts, 0))!=-1) {
+  switch (opt) {
+   case 'm':
+    config.solverMode = lookUp(optarg, kModeNames, 7);
+    if (config.solverMode<0) {
+     cout << "no mode " << optarg << endl;
+     return 1;
+    }
+    break;
+   case 'n': config.nx = config.ny = config.nz = atoi(optarg); break;
+   case kOptNx: config.nx = atoi(optarg); break;
+   case kOptNy: config.ny = atoi(optarg); break;
+   case kOptNz: config.nz = atoi(optarg); break;
+   case 's': config.totTime = atoi(optarg); break;
+   case 't': config.timestep = atof(optarg); break;
+   case 'l':
+    if (sscanf(optarg, "%lf,%lf,%lf", &config.xTotLen, &config.yTotLen, &config.zTotLen)!=3) {
+     cout << "--length wants X,Y,Z" << endl;
+     return 1;
+    }
+    break;
+   case 'D': config.dCoeff = atof(optarg); break;
+   case kOptMaxConc: config.maxConc = atof(optarg); break;
+   case kOptHolderConc: config.holderConc = atof(optarg); break;
+   case kOptNeighbours: config.walkNeighbours = atoi(optarg); break;
+   case 'S': config.walkSeed = strtoull(optarg, 0, 10); break;
+   case kOptGroups: config.fakeAvoNum = atof(optarg); break;
+   case 'j': config.nThreads = atoi(optarg); break;
+   case kOptFrontThreshold: config.frontThreshold = atof(optarg); break;
+   case kOptTileSteps: config.tileSteps = atoi(optarg); break;
+   case kOptFloat: config.floatStorage = true; break;
+   case kOptCompareDouble: config.compareDouble = true; break;
+   case kOptSourceFace:
+    config.sourceFace = lookUp(optarg, kFaceNames, 6);
+    if (config.sourceFace<0) {
+     cout << "no face " << optarg << endl;
+     return 1;
+    }
+    break;
+   case 'f': config.breakthroughFrac = atof(optarg); break;
+   case kOptUseMax: config.breakthroughUseMax = true; break;
+   case kOptDryFaces: config.breakthroughSealed = false; break;
+   case kOptMaxTime: config.breakthroughMaxTime = atof(optarg); break;
+   case kOptFixedDt: config.adaptiveTimestep = false; break;
+   case kOptGridLengths: config.analyticGridLengths = true; break;
+   case kOptValidate:
+    config.validateSolver = lookUp(optarg, kModeNames, 7);
+    if (config.validateSolver<0) {
+     cout << "no mode " << optarg << endl;
+     return 1;
+    }
+    break;
+   case kOptTemperatures: config.temperatureFile = optarg; break;
+   case kOptEa: config.activationEnergy = atof(optarg); break;
+   case kOptRefTemp: config.refTemperature = atof(optarg); break;
+   case kOptConcCoeff: config.concCoeff = atof(optarg); break;
+   case kOptHistory: config.historySteps = atoi(optarg); break;
+   case kOptSnapshotEvery: config.snapshotEvery = atoi(optarg); break;
+   case kOptSnapshotFile: config.snapshotFile = optarg; break;
+   case kOptObservables: config.observablesFile = optarg; break;
+   case kOptCheckpointEvery: config.checkpointEvery = atoi(optarg); break;
+   case kOptCheckpointFile: config.checkpointFile = optarg; break;
+   case kOptResume: config.resumeFile = optarg; break;
+   case kOptStartFrom: config.startFrom = optarg; break;
+   case kOptDry: config.drying = true; break;
+   case kOptDAir: config.dCoeffAir = atof(optarg); break;
+   case kOptSweep: sweepFile = optarg; break;
+   case kOptOut: sweepOut = optarg; break;
+   case kOptOutputEvery: outputEvery = atoi(optarg); break;
+   case 'h':
+    usage(argv[0], def);
+    return 0;
+   default:
+    usage(argv[0], def);
+    return 1;
+  }
+ }
+ if (sweepFile) {
+  std::vector<SweepScenario> scenarios;
+  if (readSweepScenarios(sweepFile, scenarios)!=0) return 1;
+  return runSweep(scenarios, sweepOut, config.nThreads, outputEvery);
+ }
+ return runDiffusion(config);
+}
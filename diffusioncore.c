@@ -0,0 +1,1885 @@
+/*core of the SNO+ 3D diffusion model for water in acrylic: the solver
+  kernels that aren't templates, and runDiffusion, which sets up the grid
+  and runs the chosen solver. See diffusioncore.h.
+*/
+#include "diffusioncore.h"
+
+using std::cout;
+using std::endl;
+
+long long counterBinomial(CounterRng &rng, long long n, double p)
+{
+ if (n<=0 || p<=0) return 0;
+ if (p>=1) return n;
+ if (p>0.5) return n - counterBinomial(rng, n, 1-p);
+
+ const double q = 1-p;
+ if (n*p<10) {
+  const double s = p/q, a = (n+1)*s;
+  double r = exp(n*log1p(-p));
+  double u = rng.uniform();
+  long long x = 0;
+  while (u>r) {
+   u -= r;
+   x++;
+   if (x>n) { //ran off the end from round off, start again
+    x = 0;
+    r = exp(n*log1p(-p));
+    u = rng.uniform();
+    continue;
+   }
+   r *= a/x - s;
+  }
+  return x;
+ }
+
+ const double spq = sqrt(n*p*q);
+ const double b = 1.15 + 2.53*spq;
+ const double a = -0.0873 + 0.0248*b + 0.01*p;
+ const double c = n*p + 0.5;
+ const double vr = 0.92 - 4.2/b;
+ const double alpha = (2.83 + 5.1/b)*spq;
+ const double r = p/q;
+ const long long m = (long long)floor((n+1)*p);
+ const double nm = n - m + 1;
+ const double h = (m+0.5)*log((m+1)/(r*nm)) + stirlingTail(m) + stirlingTail(n-m);
+ for (;;) {
+  double u, v = rng.uniform();
+  if (v<=0.86*vr) {
+   u = v/vr - 0.43;
+   return (long long)floor((2*a/(0.5-fabs(u)) + b)*u + c);
+  }
+  if (v>=vr) {
+   u = rng.uniform() - 0.5;
+  }
+  else {
+   u = v/vr - 0.93;
+   u = (u<0 ? -0.5 : 0.5) - u;
+   v = rng.uniform()*vr;
+  }
+  const double us = 0.5 - fabs(u);
+  const double kd = floor((2*a/us + b)*u + c);
+  if (kd<0 || kd>n) continue;
+  const long long k = (long long)kd;
+  v = v*alpha/(a/(us*us) + b);
+  //log of f(k)/f(m) via Stirling, to compare against log(v)
+  const double nk = n - k + 1;
+  const double bound = h + (n+1)*log(nm/nk) + (k+0.5)*log(nk*r/(k+1))
+                     - stirlingTail(k) - stirlingTail(n-k);
+  if (log(v)<=bound) return k;
+ }
+}
+
+void labelElems(unsigned char *elemLabel, int nx, int ny, int nz,
+ std::vector<long> &outerElems, std::vector<long> &waterElems)
+{
+ outerElems.clear();
+ waterElems.clear();
+ for (int k=0; k<nz; k++) {
+  for (int j=0; j<ny; j++) {
+   for (int i=0; i<nx; i++) {
+    const long elem = i + (long)nx*j + (long)nx*ny*k;
+    //layer = how many elems away from the nearest face
+    int layer = std::min(std::min(std::min(i,nx-1-i), std::min(j,ny-1-j)),
+                         std::min(k,nz-1-k));
+    if (layer==0) {
+     elemLabel[elem] = kOuterFace;
+     outerElems.push_back(elem);
+    }
+    else if (layer==1) {
+     elemLabel[elem] = kWaterLayer;
+     waterElems.push_back(elem);
+    }
+    else elemLabel[elem] = kAcrylic;
+   }
+  }
+ }
+}
+
+std::vector<long> faceLayerElems(int nx, int ny, int nz, int face, int depth)
+{
+ std::vector<long> elems;
+ const int n[3] = {nx, ny, nz};
+ const int axis = face/2;
+ const int fixedPos = (face%2==0) ? depth : n[axis]-1-depth;
+ for (int b=2; b<n[(axis+2)%3]-2; b++) {
+  for (int a=2; a<n[(axis+1)%3]-2; a++) {
+   int pos[3];
+   pos[axis] = fixedPos;
+   pos[(axis+1)%3] = a;
+   pos[(axis+2)%3] = b;
+   elems.push_back(pos[0] + (long)nx*pos[1] + (long)nx*ny*pos[2]);
+  }
+ }
+ return elems;
+}
+
+void refreshGhosts(double *conc, const std::vector<long> &ghostElems,
+ const std::vector<long> &innerElems)
+{
+ for (size_t q=0; q<ghostElems.size(); q++) conc[ghostElems[q]] = conc[innerElems[q]];
+}
+
+void stencilInit(double *elemConc, long cells, const std::vector<long> &outerElems,
+ const std::vector<long> &waterElems, double holderConc, double maxConc)
+{
+ std::fill(elemConc, elemConc+cells, 0.0);
+ applyFixedElems(elemConc, outerElems, holderConc);
+ applyFixedElems(elemConc, waterElems, maxConc);
+}
+
+//sum of water[i] - acrylic[i] for i0<=i<i1, in 4 parts so it vectorizes
+template <typename Real>
+static inline double rowLinks(const Real *water, const Real *acrylic, int i0, int i1)
+{
+ double part[4] = {0, 0, 0, 0};
+ int i = i0;
+ for (; i+4<=i1; i+=4) {
+  for (int q=0; q<4; q++) part[q] += (double)water[i+q] - acrylic[i+q];
+ }
+ for (; i<i1; i++) part[0] += (double)water[i] - acrylic[i];
+ return (part[0] + part[1]) + (part[2] + part[3]);
+}
+
+//adds r*(water - acrylic) over the links between slab k of the acrylic
+//and the water layer round it to flux (EFace order)
+template <typename Real>
+static void addSlabLinks(const Real *conc, int nx, int ny, int nz, int k,
+ double rx, double ry, double rz, double *flux)
+{
+ const long sy = nx, sz = (long)nx*ny;
+ double sum[6] = {0, 0, 0, 0, 0, 0};
+ for (int j=2; j<ny-2; j++) {
+  const Real *c = conc + k*sz + j*sy;
+  sum[kFaceXLow] += (double)c[1] - c[2];
+  sum[kFaceXHigh] += (double)c[nx-2] - c[nx-3];
+  if (j==2) sum[kFaceYLow] += rowLinks(c-sy, c, 2, nx-2);
+  if (j==ny-3) sum[kFaceYHigh] += rowLinks(c+sy, c, 2, nx-2);
+  if (k==2) sum[kFaceZLow] += rowLinks(c-sz, c, 2, nx-2);
+  if (k==nz-3) sum[kFaceZHigh] += rowLinks(c+sz, c, 2, nx-2);
+ }
+ const double r[6] = {rx, rx, ry, ry, rz, rz};
+ for (int face=0; face<6; face++) flux[face] = r[face]*sum[face];
+}
+
+//adds up the per slab link fluxes in slab order, so the total is the same
+//whichever threads did the slabs
+static void sumSlabLinks(const std::vector<double> &slabFlux, double *flux)
+{
+ for (int face=0; face<6; face++) flux[face] = 0;
+ for (size_t q=0; q<slabFlux.size(); q++) flux[q%6] += slabFlux[q];
+}
+
+template <typename Real>
+void stencilStep(const Real * __restrict__ cur, Real * __restrict__ next,
+ int nx, int ny, int nz, double rx, double ry, double rz, SlabPool &pool,
+ double *linkFlux)
+{
+ const long sy = nx;
+ const long sz = (long)nx*ny;
+ std::vector<double> slabFlux(linkFlux ? 6*(nz-4) : 0);
+ double *slabFluxOut = slabFlux.data();
+ pool.run(nz-4, [=](int slab) {
+  const int k = slab+2;
+  if (slabFluxOut) addSlabLinks(cur, nx, ny, nz, k, rx, ry, rz, slabFluxOut + 6*slab);
+  for (int j=2; j<ny-2; j++) {
+   const Real * __restrict__ c = cur + k*sz + j*sy;
+   Real * __restrict__ n = next + k*sz + j*sy;
+   for (int i=2; i<nx-2; i++) {
+    n[i] = cubeElemUpdate(c[i], c[i-1], c[i+1], c[i-sy], c[i+sy],
+                          c[i-sz], c[i+sz], rx, ry, rz);
+   }
+  }
+ });
+ if (linkFlux) sumSlabLinks(slabFlux, linkFlux);
+}
+
+ActiveFront::ActiveFront(int nx, int ny, int nz, double threshold)
+ : threshold(threshold), nx(nx), ny(ny), nz(nz)
+{
+ //about 8 tiles across each thin axis, so the ones against the water
+ //layer aren't most of the grid
+ tileI = std::max((int)kMinTileI, std::min((int)kMaxTileI, (nx-4)/8));
+ tileJ = std::max(1, std::min((int)kMaxTileJ, (ny-4)/8));
+ ti = (nx-4 + tileI-1)/tileI;
+ tj = (ny-4 + tileJ-1)/tileJ;
+ tk = nz-4;
+ live.assign((long)ti*tj*tk, 0);
+ wet.assign(live.size(), 0);
+ slabWet.assign(tk, 0);
+ //the tiles against the water layer
+ for (int c=0; c<tk; c++) {
+  for (int b=0; b<tj; b++) {
+   for (int a=0; a<ti; a++) {
+    if (a==0 || a==ti-1 || b==0 || b==tj-1 || c==0 || c==tk-1) live[tile(a, b, c)] = 1;
+   }
+  }
+ }
+}
+
+long ActiveFront::liveElems() const
+{
+ long elems = 0;
+ for (int c=0; c<tk; c++) {
+  for (int b=0; b<tj; b++) {
+   for (int a=0; a<ti; a++) {
+    if (!live[tile(a, b, c)]) continue;
+    elems += (long)(std::min((a+1)*tileI, nx-4) - a*tileI)*(std::min((b+1)*tileJ, ny-4) - b*tileJ);
+   }
+  }
+ }
+ return elems;
+}
+
+void ActiveFront::restore(const unsigned char *liveFlags, const unsigned char *wetFlags)
+{
+ for (size_t t=0; t<live.size(); t++) {
+  live[t] = liveFlags ? liveFlags[t] : 1;
+  wet[t] = wetFlags ? wetFlags[t] : kWetAll;
+ }
+ for (int c=0; c<tk; c++) {
+  bool allWet = true;
+  for (long t=tile(0, 0, c); t<tile(0, 0, c+1); t++) allWet = allWet && wet[t]==kWetAll;
+  slabWet[c] = allWet;
+ }
+}
+
+template <typename Real>
+void stencilStepActive(const Real * __restrict__ cur, Real * __restrict__ next,
+ int nx, int ny, int nz, double rx, double ry, double rz, ActiveFront &front,
+ SlabPool &pool, double *linkFlux)
+{
+ const long sy = nx;
+ const long sz = (long)nx*ny;
+ const int ti = front.tilesI(), tj = front.tilesJ(), tk = front.tilesK();
+ const int tileI = front.tileSizeI(), tileJ = front.tileSizeJ();
+ const double threshold = front.threshold;
+ ActiveFront *f = &front;
+ std::vector<double> slabFlux(linkFlux ? 6*(nz-4) : 0);
+ double *slabFluxOut = slabFlux.data();
+ pool.run(nz-4, [=](int slab) {
+  const int k = slab+2;
+  if (slabFluxOut) addSlabLinks(cur, nx, ny, nz, k, rx, ry, rz, slabFluxOut + 6*slab);
+  const unsigned char wetAll = ActiveFront::kWetAll;
+  if (f->slabWet[slab]) {
+   //the whole slab is wet, so it's just stencilStep
+   for (int j=2; j<ny-2; j++) {
+    const Real * __restrict__ c = cur + k*sz + j*sy;
+    Real * __restrict__ n = next + k*sz + j*sy;
+    for (int i=2; i<nx-2; i++) {
+     n[i] = cubeElemUpdate(c[i], c[i-1], c[i+1], c[i-sy], c[i+sy],
+                           c[i-sz], c[i+sz], rx, ry, rz);
+    }
+   }
+   return;
+  }
+  for (int b=0; b<tj; b++) {
+   const int jLo = 2 + b*tileJ, jHi = std::min(jLo + tileJ, ny-2);
+   for (int j=jLo; j<jHi; j++) {
+    const Real * __restrict__ c = cur + k*sz + j*sy;
+    Real * __restrict__ n = next + k*sz + j*sy;
+    for (int a=0; a<ti; ) {
+     const long t = f->tile(a, b, slab);
+     if (!f->live[t]) {
+      a++;
+      continue;
+     }
+     const int iLo = 2 + a*tileI;
+     if (f->wet[t]==wetAll) {
+      //tiles already wet don't need checking again, so do the whole run
+      //of them along the row in one loop
+      int aEnd = a+1;
+      while (aEnd<ti && f->live[t+aEnd-a] && f->wet[t+aEnd-a]==wetAll) aEnd++;
+      const int iHi = std::min(2 + aEnd*tileI, nx-2);
+      for (int i=iLo; i<iHi; i++) {
+       n[i] = cubeElemUpdate(c[i], c[i-1], c[i+1], c[i-sy], c[i+sy],
+                             c[i-sz], c[i+sz], rx, ry, rz);
+      }
+      a = aEnd;
+      continue;
+     }
+     const int iHi = std::min(iLo + tileI, nx-2);
+     //elems in tiles that aren't live are never written, so whatever
+     //flowed into them would be lost. The links into them are sealed
+     //instead until they go live: an elem reads its own conc for a
+     //neighbour over a dry side. Only the kWetAll tiles have all their
+     //neighbours live, so only this branch needs it.
+     const Real *yLo = j==jLo && b>0 && !f->live[t-ti] ? c : c-sy;
+     const Real *yHi = j==jHi-1 && b<tj-1 && !f->live[t+ti] ? c : c+sy;
+     const Real *zLo = slab>0 && !f->live[t-(long)ti*tj] ? c : c-sz;
+     const Real *zHi = slab<tk-1 && !f->live[t+(long)ti*tj] ? c : c+sz;
+     int over = 0; //an int OR rather than a max so the loop still vectorizes
+     for (int i=iLo; i<iHi; i++) {
+      n[i] = cubeElemUpdate(c[i], c[i-1], c[i+1], yLo[i], yHi[i],
+                            zLo[i], zHi[i], rx, ry, rz);
+      over |= fabs(n[i])>threshold;
+     }
+     const bool xLowDry = a>0 && !f->live[t-1];
+     const bool xHighDry = a<ti-1 && !f->live[t+1];
+     if (xLowDry || xHighDry) {
+      //the ends of the row again, sealed along x as well
+      const int ends[2] = {iLo, iHi-1};
+      for (int q=0; q<2; q++) {
+       const int i = ends[q];
+       n[i] = cubeElemUpdate(c[i], xLowDry && i==iLo ? c[i] : c[i-1],
+                             xHighDry && i==iHi-1 ? c[i] : c[i+1],
+                             yLo[i], yHi[i], zLo[i], zHi[i], rx, ry, rz);
+       over |= fabs(n[i])>threshold;
+      }
+     }
+     if (over) {
+      int edges = ActiveFront::kWetAny;
+      if (fabs(n[iLo])>threshold) edges |= ActiveFront::kWetXLow;
+      if (fabs(n[iHi-1])>threshold) edges |= ActiveFront::kWetXHigh;
+      if (j==jLo) edges |= ActiveFront::kWetYLow;
+      if (j==jHi-1) edges |= ActiveFront::kWetYHigh;
+      f->wet[t] |= edges;
+     }
+     a++;
+    }
+   }
+  }
+ });
+ if (linkFlux) sumSlabLinks(slabFlux, linkFlux);
+
+ //a tile goes live when the tile next to it has water over the threshold
+ //on the side they share. Only reads wet, so the slabs can go in any order.
+ pool.run(tk, [=](int c) {
+  if (f->slabWet[c]) return;
+  bool allWet = true;
+  for (int b=0; b<tj; b++) {
+   for (int a=0; a<ti; a++) {
+    const long t = f->tile(a, b, c);
+    allWet = allWet && f->wet[t]==ActiveFront::kWetAll;
+    if (f->live[t]) continue;
+    if ((a>0 && (f->wet[t-1] & ActiveFront::kWetXHigh)) ||
+        (a<ti-1 && (f->wet[t+1] & ActiveFront::kWetXLow)) ||
+        (b>0 && (f->wet[f->tile(a, b-1, c)] & ActiveFront::kWetYHigh)) ||
+        (b<tj-1 && (f->wet[f->tile(a, b+1, c)] & ActiveFront::kWetYLow)) ||
+        (c>0 && (f->wet[f->tile(a, b, c-1)] & ActiveFront::kWetAny)) ||
+        (c<tk-1 && (f->wet[f->tile(a, b, c+1)] & ActiveFront::kWetAny))) {
+     f->live[t] = 1;
+    }
+   }
+  }
+  f->slabWet[c] = allWet;
+ });
+}
+
+template <typename Real>
+void stencilStepsTiled(const Real * __restrict__ cur, Real * __restrict__ next,
+ int nx, int ny, int nz, double rx, double ry, double rz, int steps, SlabPool &pool,
+ double *linkFlux)
+{
+ if (steps<=1) {
+  stencilStep(cur, next, nx, ny, nz, rx, ry, rz, pool, linkFlux);
+  return;
+ }
+ const int T = steps;
+ const long sy = nx;
+ const long sz = (long)nx*ny;
+ const int tilesI = (nx-4 + kTimeTileI-1)/kTimeTileI;
+ const int tilesJ = (ny-4 + kTimeTileJ-1)/kTimeTileJ;
+ //each column's share of the link fluxes, added up in column order
+ //afterwards so the totals don't depend on the threads
+ std::vector<double> columnFlux(linkFlux ? (long)tilesI*tilesJ*T*6 : 0);
+ double *columnFluxOut = columnFlux.data();
+ pool.run(tilesI*tilesJ, [=](int item) {
+  const int x0 = 2 + (item%tilesI)*kTimeTileI, x1 = std::min(x0 + kTimeTileI, nx-2);
+  const int y0 = 2 + (item/tilesI)*kTimeTileJ, y1 = std::min(y0 + kTimeTileJ, ny-2);
+  //the column plus its halo, and the fixed layers next to it
+  const int xa = std::max(0, x0-T), xb = std::min(nx, x1+T);
+  const int ya = std::max(0, y0-T), yb = std::min(ny, y1+T);
+  const long lw = xb-xa, ls = lw*(yb-ya);
+
+  //3 slabs for each of the steps in between. They all start as a copy of
+  //slab 2, which gives them the fixed layers round the acrylic; only the
+  //acrylic gets written after that.
+  thread_local std::vector<Real> ring;
+  ring.resize(3*(T-1)*ls);
+  for (int slot=0; slot<3*(T-1); slot++) {
+   for (int j=ya; j<yb; j++) {
+    memcpy(&ring[slot*ls + (j-ya)*lw], cur + 2*sz + j*sy + xa, lw*sizeof(Real));
+   }
+  }
+  //row j of slab k after t steps, indexed by i. Step 0 and the fixed
+  //slabs come straight from cur.
+  Real *ringBase = ring.data();
+  auto row = [=](int t, int k, int j) -> Real* {
+   if (t==0 || k<2 || k>nz-3) return const_cast<Real*>(cur) + k*sz + j*sy;
+   return ringBase + ((t-1)*3 + k%3)*ls + (j-ya)*lw - xa;
+  };
+
+  for (int kk=2; kk<nz-2+T-1; kk++) {
+   for (int t=1; t<=T; t++) {
+    const int k = kk-(t-1);
+    if (k<2 || k>nz-3) continue;
+    const int halo = T-t;
+    const int i0 = std::max(2, x0-halo), i1 = std::min(nx-2, x1+halo);
+    const int j0 = std::max(2, y0-halo), j1 = std::min(ny-2, y1+halo);
+    for (int j=j0; j<j1; j++) {
+     const Real * __restrict__ c = row(t-1, k, j);
+     const Real * __restrict__ cFront = row(t-1, k, j-1);
+     const Real * __restrict__ cBack = row(t-1, k, j+1);
+     const Real * __restrict__ cBot = row(t-1, k-1, j);
+     const Real * __restrict__ cTop = row(t-1, k+1, j);
+     Real * __restrict__ n = t==T ? next + k*sz + j*sy : row(t, k, j);
+     for (int i=i0; i<i1; i++) {
+      n[i] = cubeElemUpdate(c[i], c[i-1], c[i+1], cFront[i], cBack[i],
+                            cBot[i], cTop[i], rx, ry, rz);
+     }
+    }
+    if (!columnFluxOut) continue;
+    //links out of the part of slab k this column owns (not its halo), at
+    //the start of step t, while the slab is still in cache
+    double *flux = columnFluxOut + ((long)item*T + t-1)*6;
+    for (int j=y0; j<y1 && x0==2; j++) {
+     const Real *c = row(t-1, k, j);
+     flux[kFaceXLow] += (double)c[1] - c[2];
+    }
+    for (int j=y0; j<y1 && x1==nx-2; j++) {
+     const Real *c = row(t-1, k, j);
+     flux[kFaceXHigh] += (double)c[nx-2] - c[nx-3];
+    }
+    if (y0==2) flux[kFaceYLow] += rowLinks(row(t-1, k, 1), row(t-1, k, 2), x0, x1);
+    if (y1==ny-2) flux[kFaceYHigh] += rowLinks(row(t-1, k, ny-2), row(t-1, k, ny-3), x0, x1);
+    for (int j=y0; j<y1 && (k==2 || k==nz-3); j++) {
+     const Real *c = row(t-1, k, j);
+     if (k==2) flux[kFaceZLow] += rowLinks(row(t-1, k-1, j), c, x0, x1);
+     if (k==nz-3) flux[kFaceZHigh] += rowLinks(row(t-1, k+1, j), c, x0, x1);
+    }
+   }
+  }
+ });
+ if (!linkFlux) return;
+ const double r[6] = {rx, rx, ry, ry, rz, rz};
+ for (int q=0; q<T*6; q++) linkFlux[q] = 0;
+ for (int item=0; item<tilesI*tilesJ; item++) {
+  for (int q=0; q<T*6; q++) linkFlux[q] += columnFlux[(long)item*T*6 + q];
+ }
+ for (int q=0; q<T*6; q++) linkFlux[q] *= r[q%6];
+}
+
+//the explicit kernels for double grids, and float ones for floatStorage
+#define INSTANTIATE_STENCIL(Real) \
+ template void stencilStep<Real>(const Real*, Real*, int, int, int, double, double, double, \
+                                 SlabPool&, double*); \
+ template void stencilStepActive<Real>(const Real*, Real*, int, int, int, double, double, \
+                                       double, ActiveFront&, SlabPool&, double*); \
+ template void stencilStepsTiled<Real>(const Real*, Real*, int, int, int, double, double, \
+                                       double, int, SlabPool&, double*);
+INSTANTIATE_STENCIL(double)
+INSTANTIATE_STENCIL(float)
+#undef INSTANTIATE_STENCIL
+
+void stencilStepLanes(const double * __restrict__ cur, double * __restrict__ next,
+ int nx, int ny, int nz, const double *rx, const double *ry, const double *rz,
+ SlabPool &pool)
+{
+ const int L = kSweepLanes;
+ const long sy = (long)nx*L;
+ const long sz = (long)nx*ny*L;
+ double lrx[L], lry[L], lrz[L];
+ for (int l=0; l<L; l++) { lrx[l] = rx[l]; lry[l] = ry[l]; lrz[l] = rz[l]; }
+ pool.run(nz-4, [=](int slab) {
+  const int k = slab+2;
+  for (int j=2; j<ny-2; j++) {
+   const double * __restrict__ c = cur + k*sz + j*sy;
+   double * __restrict__ n = next + k*sz + j*sy;
+   for (long q=2*L; q<(long)(nx-2)*L; q+=L) {
+    for (int l=0; l<L; l++) {
+     n[q+l] = cubeElemUpdate(c[q+l], c[q+l-L], c[q+l+L], c[q+l-sy], c[q+l+sy],
+                             c[q+l-sz], c[q+l+sz], lrx[l], lry[l], lrz[l]);
+    }
+   }
+  }
+ });
+}
+
+void setFaceCoeffs(const double *cellD, double dScale, int nx, int ny, int nz,
+ double sx, double sy, double sz, FaceCoeffs &faces, SlabPool &pool)
+{
+ const long sj = nx;
+ const long sk = (long)nx*ny;
+ double *kxOut = &faces.kx[0], *kyOut = &faces.ky[0], *kzOut = &faces.kz[0];
+ //z-slabs 1 to nz-3: the water layer's slab below the acrylic has the
+ //z faces into it, and the acrylic's own slabs everything
+ pool.run(nz-3, [=](int slab) {
+  const int k = slab+1;
+  const double hx = 0.5*dScale*sx, hy = 0.5*dScale*sy, hz = 0.5*dScale*sz;
+  for (int j=1; j<ny-2; j++) {
+   const long row = k*sk + j*sj;
+   double * __restrict__ kx = kxOut + row;
+   double * __restrict__ ky = kyOut + row;
+   double * __restrict__ kz = kzOut + row;
+   if (cellD) {
+    const double * __restrict__ d = cellD + row;
+    for (int i=1; i<nx-2; i++) {
+     kx[i] = hx*(d[i] + d[i+1]);
+     ky[i] = hy*(d[i] + d[i+sj]);
+     kz[i] = hz*(d[i] + d[i+sk]);
+    }
+   }
+   else {
+    for (int i=1; i<nx-2; i++) {
+     kx[i] = 2*hx;
+     ky[i] = 2*hy;
+     kz[i] = 2*hz;
+    }
+   }
+  }
+ });
+}
+
+//sum of k[i]*(water[i] - acrylic[i]) for i0<=i<i1, in 4 parts so it
+//vectorizes
+static inline double rowLinks(const double *water, const double *acrylic, const double *k,
+ int i0, int i1)
+{
+ double part[4] = {0, 0, 0, 0};
+ int i = i0;
+ for (; i+4<=i1; i+=4) {
+  for (int q=0; q<4; q++) part[q] += k[i+q]*(water[i+q] - acrylic[i+q]);
+ }
+ for (; i<i1; i++) part[0] += k[i]*(water[i] - acrylic[i]);
+ return (part[0] + part[1]) + (part[2] + part[3]);
+}
+
+void variableStencilStep(const double * __restrict__ cur, double * __restrict__ next,
+ int nx, int ny, int nz, const FaceCoeffs &faces, SlabPool &pool, double *linkFlux)
+{
+ const long sy = nx;
+ const long sz = (long)nx*ny;
+ const double *kxAll = &faces.kx[0], *kyAll = &faces.ky[0], *kzAll = &faces.kz[0];
+ std::vector<double> slabFlux(linkFlux ? 6*(nz-4) : 0);
+ double *slabFluxOut = slabFlux.data();
+ pool.run(nz-4, [=](int slab) {
+  const int k = slab+2;
+  if (slabFluxOut) {
+   //the face on the water side of each link is the one the link is
+   //across: below or behind the acrylic it belongs to the water elem
+   double *flux = slabFluxOut + 6*slab;
+   for (int face=0; face<6; face++) flux[face] = 0;
+   for (int j=2; j<ny-2; j++) {
+    const long row = k*sz + j*sy;
+    const double *c = cur + row;
+    flux[kFaceXLow] += kxAll[row+1]*(c[1] - c[2]);
+    flux[kFaceXHigh] += kxAll[row+nx-3]*(c[nx-2] - c[nx-3]);
+    if (j==2) flux[kFaceYLow] += rowLinks(c-sy, c, kyAll+row-sy, 2, nx-2);
+    if (j==ny-3) flux[kFaceYHigh] += rowLinks(c+sy, c, kyAll+row, 2, nx-2);
+    if (k==2) flux[kFaceZLow] += rowLinks(c-sz, c, kzAll+row-sz, 2, nx-2);
+    if (k==nz-3) flux[kFaceZHigh] += rowLinks(c+sz, c, kzAll+row, 2, nx-2);
+   }
+  }
+  for (int j=2; j<ny-2; j++) {
+   const long row = k*sz + j*sy;
+   const double * __restrict__ c = cur + row;
+   const double * __restrict__ kx = kxAll + row;
+   const double * __restrict__ kyLow = kyAll + row - sy;
+   const double * __restrict__ kyHigh = kyAll + row;
+   const double * __restrict__ kzLow = kzAll + row - sz;
+   const double * __restrict__ kzHigh = kzAll + row;
+   double * __restrict__ n = next + row;
+   for (int i=2; i<nx-2; i++) {
+    n[i] = c[i] + kx[i-1]*(c[i-1]-c[i]) + kx[i]*(c[i+1]-c[i])
+                + kyLow[i]*(c[i-sy]-c[i]) + kyHigh[i]*(c[i+sy]-c[i])
+                + kzLow[i]*(c[i-sz]-c[i]) + kzHigh[i]*(c[i+sz]-c[i]);
+   }
+  }
+ });
+ if (linkFlux) sumSlabLinks(slabFlux, linkFlux);
+}
+
+double TemperatureSchedule::at(double t) const
+{
+ if (time.empty()) return 0;
+ if (t<=time.front()) return kelvin.front();
+ if (t>=time.back()) return kelvin.back();
+ const size_t q = std::upper_bound(time.begin(), time.end(), t) - time.begin();
+ const double f = (t - time[q-1])/(time[q] - time[q-1]);
+ return kelvin[q-1] + f*(kelvin[q] - kelvin[q-1]);
+}
+
+double TemperatureSchedule::hottest() const
+{
+ return kelvin.empty() ? 0 : *std::max_element(kelvin.begin(), kelvin.end());
+}
+
+int readTemperatureSchedule(const char *fileName, TemperatureSchedule &schedule)
+{
+ schedule.time.clear();
+ schedule.kelvin.clear();
+ FILE *file = fopen(fileName, "r");
+ if (!file) {
+  cout << "can't open temperature schedule " << fileName << endl;
+  return 1;
+ }
+ char line[1024];
+ int lineNo = 0;
+ while (fgets(line, sizeof(line), file)) {
+  lineNo++;
+  const char *p = line + strspn(line, " \t");
+  if (*p=='#' || *p=='\n' || *p=='\r' || *p==0) continue;
+  double t, kelvin;
+  if (sscanf(p, "%lf , %lf", &t, &kelvin)!=2) {
+   if (schedule.time.empty()) continue; //header
+   cout << fileName << ":" << lineNo << ": want time,temperature" << endl;
+   fclose(file);
+   return 1;
+  }
+  if ((!schedule.time.empty() && t<=schedule.time.back()) || kelvin<=0) {
+   cout << fileName << ":" << lineNo << ": times must go up and temperatures be in kelvin" << endl;
+   fclose(file);
+   return 1;
+  }
+  schedule.time.push_back(t);
+  schedule.kelvin.push_back(kelvin);
+ }
+ fclose(file);
+ if (schedule.time.empty()) {
+  cout << "no temperatures in " << fileName << endl;
+  return 1;
+ }
+ return 0;
+}
+
+void thomasFactor(double thetaR, int n, double *cp, double *m,
+ bool lowSealed, bool highSealed)
+{
+ const double a = -thetaR, b = 1+2*thetaR;
+ for (int q=0; q<n; q++) {
+  double diag = b;
+  if (q==0 && lowSealed) diag -= thetaR;
+  if (q==n-1 && highSealed) diag -= thetaR;
+  m[q] = 1/(q==0 ? diag : diag - a*cp[q-1]);
+  cp[q] = a*m[q];
+ }
+}
+
+double adiStep(double * __restrict__ conc, double * __restrict__ delta,
+ int nx, int ny, int nz, double rx, double ry, double rz, double theta,
+ double *work, SlabPool &pool, int sealedFaces, double *totalChange)
+{
+ const long sy = nx;
+ const long sz = (long)nx*ny;
+ const int ni = nx-4, nj = ny-4, nk = nz-4; //unknowns per line
+ double *cpx = work, *mx = work+nx, *cpy = work+2*nx, *my = work+2*nx+ny;
+ double *cpz = work+2*(nx+ny), *mz = work+2*(nx+ny)+nz;
+ thomasFactor(theta*rx, ni, cpx, mx, sealedFaces>>kFaceXLow & 1, sealedFaces>>kFaceXHigh & 1);
+ thomasFactor(theta*ry, nj, cpy, my, sealedFaces>>kFaceYLow & 1, sealedFaces>>kFaceYHigh & 1);
+ thomasFactor(theta*rz, nk, cpz, mz, sealedFaces>>kFaceZLow & 1, sealedFaces>>kFaceZHigh & 1);
+ const double ax = -theta*rx, ay = -theta*ry, az = -theta*rz;
+
+ //right hand side, the explicit change, then the x sweep: lines are
+ //contiguous, one scalar Thomas solve per line
+ pool.run(nk, [=](int slab) {
+  const int k = slab+2;
+  for (int j=2; j<ny-2; j++) {
+   const double * __restrict__ c = conc + k*sz + j*sy;
+   double * __restrict__ d = delta + k*sz + j*sy;
+   for (int i=2; i<nx-2; i++) {
+    d[i] = cubeElemUpdate(c[i], c[i-1], c[i+1], c[i-sy], c[i+sy],
+                          c[i-sz], c[i+sz], rx, ry, rz) - c[i];
+   }
+   d += 2;
+   d[0] *= mx[0];
+   for (int q=1; q<ni; q++) d[q] = (d[q] - ax*d[q-1])*mx[q];
+   for (int q=ni-2; q>=0; q--) d[q] -= cpx[q]*d[q+1];
+  }
+
+  //y sweep: run the recurrence along j for a whole row of i at once so the
+  //inner loop stays unit stride
+  double *base = delta + k*sz + 2;
+  for (int i=0; i<ni; i++) base[2*sy+i] *= my[0];
+  for (int q=1; q<nj; q++) {
+   double * __restrict__ d = base + (q+2)*sy;
+   const double * __restrict__ dm = base + (q+1)*sy;
+   for (int i=0; i<ni; i++) d[i] = (d[i] - ay*dm[i])*my[q];
+  }
+  for (int q=nj-2; q>=0; q--) {
+   double * __restrict__ d = base + (q+2)*sy;
+   const double * __restrict__ dp = base + (q+3)*sy;
+   for (int i=0; i<ni; i++) d[i] -= cpy[q]*dp[i];
+  }
+ });
+
+ //z sweep: same again along k, a whole xz plane at a time
+ pool.run(nj, [=](int slab) {
+  const int j = slab+2;
+  double *base = delta + j*sy + 2;
+  for (int i=0; i<ni; i++) base[2*sz+i] *= mz[0];
+  for (int q=1; q<nk; q++) {
+   double * __restrict__ d = base + (q+2)*sz;
+   const double * __restrict__ dm = base + (q+1)*sz;
+   for (int i=0; i<ni; i++) d[i] = (d[i] - az*dm[i])*mz[q];
+  }
+  for (int q=nk-2; q>=0; q--) {
+   double * __restrict__ d = base + (q+2)*sz;
+   const double * __restrict__ dp = base + (q+3)*sz;
+   for (int i=0; i<ni; i++) d[i] -= cpz[q]*dp[i];
+  }
+ });
+
+ std::vector<double> slabMax(nk), slabSum(nk);
+ double *slabMaxOut = &slabMax[0], *slabSumOut = &slabSum[0];
+ pool.run(nk, [=](int slab) {
+  const int k = slab+2;
+  double biggest = 0, sum = 0;
+  for (int j=2; j<ny-2; j++) {
+   double * __restrict__ c = conc + k*sz + j*sy;
+   const double * __restrict__ d = delta + k*sz + j*sy;
+   for (int i=2; i<nx-2; i++) {
+    c[i] += d[i];
+    biggest = std::max(biggest, fabs(d[i]));
+    sum += d[i];
+   }
+  }
+  slabMaxOut[slab] = biggest;
+  slabSumOut[slab] = sum;
+ });
+ //added up in slab order, so it's the same whatever the threads
+ if (totalChange) {
+  *totalChange = 0;
+  for (int slab=0; slab<nk; slab++) *totalChange += slabSum[slab];
+ }
+ return *std::max_element(slabMax.begin(), slabMax.end());
+}
+
+//sum over odd m of coeff(m)*exp(-(m pi)^2 tau) for tau>0, stopping once
+//the terms are too small to matter. coeff must be bounded by 4/(m pi).
+template <typename Coeff>
+static double oddSeries(double tau, Coeff coeff)
+{
+ const double pi2 = M_PI*M_PI;
+ double sum = 0;
+ for (long m=1; ; m+=2) {
+  const double decay = exp(-m*m*pi2*tau);
+  if (decay<1e-17*m) break;
+  sum += coeff(m)*decay;
+ }
+ return sum;
+}
+
+//sum over odd m of 8/(m pi)^2 exp(-(m pi)^2 tau), 1 at tau=0
+static double uptakeSeries(double tau)
+{
+ if (tau<=0) return 1;
+ return oddSeries(tau, [](long m) { return 8/(m*m*M_PI*M_PI); });
+}
+
+//sum over odd m of 4/(m pi) sin(m pi f) exp(-(m pi)^2 tau), 1 inside at tau=0
+static double concSeries(double f, double tau)
+{
+ if (f<=0 || f>=1) return 0;
+ if (tau<=0) return 1;
+ return oddSeries(tau, [f](long m) { return 4/(m*M_PI)*sin(m*M_PI*f); });
+}
+
+double boxUptakeFraction(double tauX, double tauY, double tauZ)
+{
+ return 1 - uptakeSeries(tauX)*uptakeSeries(tauY)*uptakeSeries(tauZ);
+}
+
+double boxConcFraction(double fx, double fy, double fz, double tauX, double tauY,
+ double tauZ)
+{
+ return 1 - concSeries(fx, tauX)*concSeries(fy, tauY)*concSeries(fz, tauZ);
+}
+
+double slabConcFraction(double fx, double tau)
+{
+ //the slab twice as thick, wet both sides, is symmetric about the sealed face
+ return 1 - concSeries(0.5*fx, 0.25*tau);
+}
+
+double slabBreakthroughTau(double fx, double frac)
+{
+ if (frac<=0 || frac>=1) return -1;
+ //the conc only goes up with time, so double tau until it's past frac and
+ //then halve the gap until it's pinned down
+ double lo = 0, hi = 1e-3;
+ while (slabConcFraction(fx, hi)<frac) {
+  lo = hi;
+  hi *= 2;
+ }
+ for (int iter=0; iter<100 && hi-lo>1e-15*hi; iter++) {
+  const double mid = 0.5*(lo+hi);
+  if (slabConcFraction(fx, mid)<frac) lo = mid;
+  else hi = mid;
+ }
+ return 0.5*(lo+hi);
+}
+
+UptakeObservables::UptakeObservables(int nx, int ny, int nz, double elemVol,
+ const double *conc, int sealedFaces)
+ : elemVol(elemVol), initialMoles(0), absorbed(0), nx(nx), ny(ny), nz(nz),
+   sealedFaces(sealedFaces)
+{
+ for (int face=0; face<6; face++) faceTotal[face] = 0;
+ if (conc) initialMoles = addUpAcrylic(conc);
+}
+
+void UptakeObservables::linkFlux(const double *conc, double rx, double ry, double rz,
+ double flux[6]) const
+{
+ std::vector<double> slabFlux(6*(nz-4));
+ for (int k=2; k<nz-2; k++) addSlabLinks(conc, nx, ny, nz, k, rx, ry, rz, &slabFlux[6*(k-2)]);
+ sumSlabLinks(slabFlux, flux);
+ for (int face=0; face<6; face++) if (sealedFaces>>face & 1) flux[face] = 0;
+}
+
+void UptakeObservables::addStep(long long step, double time, const double flux[6])
+{
+ UptakeSample sample;
+ sample.step = step;
+ sample.time = time;
+ for (int face=0; face<6; face++) {
+  sample.faceFlux[face] = flux[face]*elemVol;
+  faceTotal[face] += sample.faceFlux[face];
+  absorbed += sample.faceFlux[face];
+ }
+ sample.absorbed = absorbed;
+ series.push_back(sample);
+}
+
+template <typename Real>
+double UptakeObservables::addUpAcrylic(const Real *conc) const
+{
+ const long sy = nx, sz = (long)nx*ny;
+ double sum = 0;
+ for (int k=2; k<nz-2; k++) {
+  for (int j=2; j<ny-2; j++) {
+   const Real *c = conc + k*sz + j*sy;
+   for (int i=2; i<nx-2; i++) sum += c[i];
+  }
+ }
+ return sum*elemVol;
+}
+
+template <typename Real>
+double UptakeObservables::conservationError(const Real *conc) const
+{
+ const double error = addUpAcrylic(conc) - acrylicMoles();
+ return absorbed!=0 ? error/fabs(absorbed) : error;
+}
+template double UptakeObservables::conservationError<double>(const double*) const;
+template double UptakeObservables::conservationError<float>(const float*) const;
+
+bool UptakeObservables::write(const char *fileName) const
+{
+ FILE *out = fopen(fileName, "w");
+ if (!out) return false;
+ fprintf(out, "step,time,absorbed,x-,x+,y-,y+,z-,z+\n");
+ for (size_t q=0; q<series.size(); q++) {
+  const UptakeSample &s = series[q];
+  fprintf(out, "%lld,%.9g,%.9g", s.step, s.time, s.absorbed);
+  for (int face=0; face<6; face++) fprintf(out, ",%.9g", s.faceFlux[face]);
+  fprintf(out, "\n");
+ }
+ fclose(out);
+ return true;
+}
+
+std::string checkpointSeriesFile(const char *fileName)
+{
+ return std::string(fileName) + ".series";
+}
+
+//cuts the series file back to checkpoint.seriesFrom samples and adds
+//checkpoint.series after them
+static bool appendSeries(const char *fileName, const Checkpoint &checkpoint)
+{
+ if (checkpoint.series.empty()) return true;
+ const std::string seriesName = checkpointSeriesFile(fileName);
+ FILE *out = fopen(seriesName.c_str(), checkpoint.seriesFrom>0 ? "r+b" : "wb");
+ if (!out) return false;
+ const off_t keep = (off_t)checkpoint.seriesFrom*sizeof(UptakeSample);
+ bool ok = ftruncate(fileno(out), keep)==0 && fseeko(out, keep, SEEK_SET)==0;
+ ok = ok && fwrite(checkpoint.series.data(), sizeof(UptakeSample), checkpoint.series.size(), out)==
+            checkpoint.series.size();
+ ok = ok && fflush(out)==0 && fsync(fileno(out))==0;
+ return fclose(out)==0 && ok;
+}
+
+bool writeCheckpoint(const char *fileName, const Checkpoint &checkpoint)
+{
+ //the samples go first, so a checkpoint never points past the series file
+ if (!appendSeries(fileName, checkpoint)) return false;
+ const std::string tmpName = std::string(fileName) + ".tmp";
+ FILE *out = fopen(tmpName.c_str(), "wb");
+ if (!out) return false;
+ const CheckpointHeader &header = checkpoint.header;
+ bool ok = fwrite(&header, sizeof(header), 1, out)==1;
+ ok = ok && fwrite(checkpoint.conc.data(), sizeof(double), checkpoint.conc.size(), out)==checkpoint.conc.size();
+ ok = ok && fwrite(checkpoint.live.data(), 1, header.frontTiles, out)==(size_t)header.frontTiles;
+ ok = ok && fwrite(checkpoint.wet.data(), 1, header.frontTiles, out)==(size_t)header.frontTiles;
+ //on disk before it replaces the old one
+ ok = ok && fflush(out)==0 && fsync(fileno(out))==0;
+ ok = fclose(out)==0 && ok;
+ if (ok) ok = rename(tmpName.c_str(), fileName)==0;
+ if (!ok) remove(tmpName.c_str());
+ return ok;
+}
+
+bool readCheckpoint(const char *fileName, Checkpoint &checkpoint)
+{
+ FILE *in = fopen(fileName, "rb");
+ if (!in) return false;
+ CheckpointHeader &header = checkpoint.header;
+ bool ok = fread(&header, sizeof(header), 1, in)==1 && memcmp(header.magic, "DIFCHKP1", 8)==0 &&
+           header.nx>0 && header.ny>0 && header.nz>0 && header.frontTiles>=0 && header.seriesLength>=0;
+ if (ok) {
+  const long cells = (long)header.nx*header.ny*header.nz;
+  checkpoint.conc.resize(cells);
+  checkpoint.live.resize(header.frontTiles);
+  checkpoint.wet.resize(header.frontTiles);
+  ok = fread(checkpoint.conc.data(), sizeof(double), cells, in)==(size_t)cells &&
+       fread(checkpoint.live.data(), 1, header.frontTiles, in)==(size_t)header.frontTiles &&
+       fread(checkpoint.wet.data(), 1, header.frontTiles, in)==(size_t)header.frontTiles;
+ }
+ //up to version 3 the series was in the checkpoint itself
+ if (ok && header.version<4) {
+  checkpoint.series.resize(header.seriesLength);
+  ok = fread(checkpoint.series.data(), sizeof(UptakeSample), header.seriesLength, in)==
+       (size_t)header.seriesLength;
+ }
+ fclose(in);
+ checkpoint.seriesFrom = 0;
+ if (ok && header.version>=4) {
+  checkpoint.series.resize(header.seriesLength);
+  if (header.seriesLength>0) {
+   FILE *seriesIn = fopen(checkpointSeriesFile(fileName).c_str(), "rb");
+   ok = seriesIn && fread(checkpoint.series.data(), sizeof(UptakeSample), header.seriesLength,
+                          seriesIn)==(size_t)header.seriesLength;
+   if (seriesIn) fclose(seriesIn);
+  }
+ }
+ return ok;
+}
+
+DiffusionConfig::DiffusionConfig()
+ : solverMode(kRandomWalk), nx(5), ny(5), nz(5), totTime(50), timestep(0),
+   walkNeighbours(27), walkSeed(4357), nThreads(0), fakeAvoNum(1e5),
+   tileSteps(0), frontThreshold(0),
+   // measurements are taken based on whatever acrylic sample you're doing
+   // these are based off Tom's 3rd dogbone and are in metres
+   xTotLen(0.01888), yTotLen(0.00617), zTotLen(0.20320),
+   //Tom's RT 'soak' D value, 3.65x10^-7 m^2/day converted into m^2/s
+   dCoeff(4.22e-12), maxConc(0), holderConc(0.003),
+   sourceFace(kFaceYLow), breakthroughFrac(0.5), breakthroughUseMax(false),
+   breakthroughSealed(true), breakthroughMaxTime(3.15e7), adaptiveTimestep(true),
+   historySteps(0), snapshotEvery(0), snapshotFile("diffusion_snapshots.dat"),
+   observablesFile(0), checkpointEvery(0), checkpointFile("diffusion_checkpoint.dat"),
+   resumeFile(0), startFrom(0), drying(false), dCoeffAir(0), floatStorage(false),
+   compareDouble(false), plotQueue(0), plotEvery(0),
+   analyticGridLengths(false), validateSolver(-1), temperatureFile(0), activationEnergy(0),
+   refTemperature(293.15), concCoeff(0)
+{
+}
+
+double waterLayerConc(const DiffusionConfig &config)
+{
+ if (config.maxConc>0) return config.maxConc;
+ //the decimal # is given by (2% of acrylic in mass) divided by water's
+ //molecular weight
+ return 0.0262599/(config.xTotLen*config.yTotLen*config.zTotLen);
+}
+
+//what every solver needs to know about the grid, worked out once from
+//the config
+struct GridSetup {
+ int nx, ny, nz;
+ long cells;
+ double xLen, yLen, zLen; //x,y,and z lengths of each cube
+ double elemVol;
+ double maxConc, holderConc;
+ double dCoeff; //dCoeffAir when drying
+ long centreElem;
+ std::vector<unsigned char> elemLabel;
+ std::vector<long> outerElems, waterElems;
+ int nThreads;
+ const Checkpoint *start; //state to start from, 0 for the beginning
+ bool quiet; //no printouts, for the double run of compareDouble
+ int plotEvery; //steps between concs offered to config.plotQueue
+ TemperatureSchedule temperatures; //kVariableStencil, empty for refTemperature
+};
+
+//header for a checkpoint of this run after step steps, dt 0 for the walks
+static CheckpointHeader checkpointHeader(const DiffusionConfig &config, const GridSetup &grid,
+ long long step, double time, double dt)
+{
+ CheckpointHeader header;
+ memset(&header, 0, sizeof(header));
+ memcpy(header.magic, "DIFCHKP1", 8);
+ //1 had one wet flag per tile, not ActiveFront's edge bits; 2 only had
+ //the dt asked for, 0 when the solver picked it; 3 had the series in it
+ header.version = 4;
+ header.solverMode = config.solverMode;
+ header.nx = config.nx; header.ny = config.ny; header.nz = config.nz;
+ header.walkNeighbours = config.walkNeighbours;
+ header.step = step;
+ header.time = time;
+ header.timestep = dt;
+ header.timestepAsked = config.timestep;
+ header.xTotLen = config.xTotLen; header.yTotLen = config.yTotLen; header.zTotLen = config.zTotLen;
+ header.dCoeff = grid.dCoeff;
+ header.maxConc = grid.maxConc;
+ header.holderConc = grid.holderConc;
+ header.fakeAvoNum = config.fakeAvoNum;
+ header.walkSeed = config.walkSeed;
+ return header;
+}
+
+//the concs a run starts from: grid.start's if there is one, with the fixed
+//layers set from this run's config
+static void startConc(const GridSetup &grid, double *conc)
+{
+ if (grid.start) memcpy(conc, grid.start->conc.data(), grid.cells*sizeof(double));
+ else std::fill(conc, conc+grid.cells, 0.0);
+ applyFixedElems(conc, grid.outerElems, grid.holderConc);
+ applyFixedElems(conc, grid.waterElems, grid.maxConc);
+}
+
+//the link fluxes at the two ends of an ADI step, theta mixed, don't add up
+//to what Douglas-Gunn actually moved into the acrylic (the difference
+//grows with dt), so the faces get their share of the real total instead
+static void adiStepFlux(const double startFlux[6], const double endFlux[6], double theta,
+ double totalChange, double flux[6])
+{
+ double sum = 0;
+ for (int face=0; face<6; face++) {
+  flux[face] = (1-theta)*startFlux[face] + theta*endFlux[face];
+  sum += flux[face];
+ }
+ if (sum!=0) for (int face=0; face<6; face++) flux[face] *= totalChange/sum;
+}
+
+//puts the observables back as they were when a checkpoint was saved
+static void restoreUptake(const Checkpoint &start, UptakeObservables &uptake)
+{
+ uptake.initialMoles = start.header.initialMoles;
+ uptake.absorbed = start.header.absorbed;
+ for (int face=0; face<6; face++) uptake.faceTotal[face] = start.header.faceTotal[face];
+ uptake.series = start.series;
+}
+
+//uptake samples already in the series file this run checkpoints to: the
+//resumed run's, if it's saving over the checkpoint it carried on from
+static long long seriesOnDisk(const DiffusionConfig &config, const GridSetup &grid)
+{
+ if (!grid.start || !config.resumeFile || !config.checkpointFile) return 0;
+ if (strcmp(config.resumeFile, config.checkpointFile)!=0) return 0;
+ return grid.start->header.seriesLength;
+}
+
+//prints the total uptake and how well it adds up, and writes the time
+//series out if asked for
+template <typename Real>
+static void reportUptake(const DiffusionConfig &config, const UptakeObservables &uptake,
+ const Real *conc)
+{
+ cout << "water taken up:" << uptake.absorbed << " moles conservation error:"
+      << uptake.conservationError(conc) << endl;
+ if (config.observablesFile && !uptake.write(config.observablesFile)) {
+  cout << "can't open observables file " << config.observablesFile << endl;
+ }
+}
+
+//how long does water going in one side take to get to the other side?
+//ADI from a single wet face, checking the acrylic next to the opposite
+//face after every step (only that layer, not the whole grid) and stopping
+//as soon as it crosses the threshold.
+static void runBreakthrough(const DiffusionConfig &config, const GridSetup &grid,
+ SnapshotHistory &history, std::vector<double> *finalConc)
+{
+ const int nx = grid.nx, ny = grid.ny, nz = grid.nz;
+ const double maxConc = grid.maxConc, D = grid.dCoeff;
+ std::vector<double> conc(grid.cells, 0.0), delta(grid.cells, 0.0);
+ std::vector<double> adiWork(2*(nx+ny+nz));
+ SlabPool pool(grid.nThreads);
+
+ applyFixedElems(&conc[0], faceLayerElems(nx, ny, nz, config.sourceFace, 1), maxConc);
+ const std::vector<long> farElems = faceLayerElems(nx, ny, nz, config.sourceFace^1, 2);
+ int sealedFaces = 0;
+ std::vector<long> ghostElems, innerElems;
+ for (int face=0; face<6 && config.breakthroughSealed; face++) {
+  if (face==config.sourceFace) continue;
+  sealedFaces |= 1<<face;
+  std::vector<long> ghosts = faceLayerElems(nx, ny, nz, face, 1);
+  std::vector<long> inners = faceLayerElems(nx, ny, nz, face, 2);
+  ghostElems.insert(ghostElems.end(), ghosts.begin(), ghosts.end());
+  innerElems.insert(innerElems.end(), inners.begin(), inners.end());
+ }
+
+ UptakeObservables uptake(nx, ny, nz, grid.elemVol, &conc[0], sealedFaces);
+ double stepFlux[6], endFlux[6];
+
+ const double threshold = config.breakthroughFrac*maxConc;
+ double dt = config.timestep>0 ? config.timestep : 60;
+ const double dtLargest = 86400; //never more than a day per step
+ double timeNow = 0, prevTime = 0, prevValue = 0;
+ long long steps = 0;
+ bool crossed = false;
+ while (timeNow<config.breakthroughMaxTime) {
+  refreshGhosts(&conc[0], ghostElems, innerElems);
+  const double theta = steps<2 ? 1 : 0.5;
+  const double rx = D*dt/(grid.xLen*grid.xLen);
+  const double ry = D*dt/(grid.yLen*grid.yLen);
+  const double rz = D*dt/(grid.zLen*grid.zLen);
+  double startFlux[6], totalChange;
+  uptake.linkFlux(&conc[0], rx, ry, rz, startFlux);
+  double change = adiStep(&conc[0], &delta[0], nx, ny, nz, rx, ry, rz,
+                          theta, &adiWork[0], pool, sealedFaces, &totalChange);
+  uptake.linkFlux(&conc[0], rx, ry, rz, endFlux);
+  adiStepFlux(startFlux, endFlux, theta, totalChange, stepFlux);
+  timeNow += dt;
+  steps++;
+  uptake.addStep(steps, timeNow, stepFlux);
+  history.record(steps, timeNow, &conc[0]);
+
+  double value = 0;
+  for (size_t q=0; q<farElems.size(); q++) {
+   if (config.breakthroughUseMax) value = std::max(value, conc[farElems[q]]);
+   else value += conc[farElems[q]];
+  }
+  if (!config.breakthroughUseMax) value /= farElems.size();
+
+  if (value>=threshold) {
+   //straight line between the last two steps for when it crossed
+   double crossTime = prevTime + (threshold-prevValue)/(value-prevValue)*(timeNow-prevTime);
+   cout << "breakthrough after " << crossTime << " s (" << crossTime/86400 << " days), "
+        << steps << " steps" << endl;
+   crossed = true;
+   break;
+  }
+  //coarsen while nothing much is happening, but not so much that the
+  //far face jumps a big part of the way to the threshold in one step
+  if (config.adaptiveTimestep) {
+   if (change>0.02*maxConc) dt *= 0.5;
+   else if (change<0.002*maxConc && value-prevValue<0.05*threshold) dt = std::min(1.5*dt, dtLargest);
+  }
+  prevTime = timeNow;
+  prevValue = value;
+ }
+ if (!crossed) {
+  cout << "no breakthrough after " << timeNow << " s, far face conc " << prevValue
+       << " of " << threshold << endl;
+ }
+ reportUptake(config, uptake, &conc[0]);
+ if (finalConc) finalConc->swap(conc);
+}
+
+//kAnalytic goes at the explicit stencil's pace, but any dt is fine for it
+double gridTimestep(const DiffusionConfig &config, double D, double xLen, double yLen,
+ double zLen, bool warn)
+{
+ const double dtMax = 0.5/(D*(1/(xLen*xLen)+1/(yLen*yLen)+1/(zLen*zLen)));
+ double dt = config.timestep;
+ if (config.solverMode==kImplicitADI) {
+  if (dt<=0) dt = 3600;
+ }
+ else if (dt<=0) dt = 0.9*dtMax;
+ else if (dt>dtMax && config.solverMode!=kAnalytic) {
+  if (warn) {
+   cout << "timestep " << dt << " s is over the stability limit, using " << dtMax << " s" << endl;
+  }
+  dt = dtMax;
+ }
+ return dt;
+}
+
+//a resumed run carries on at the checkpoint's dt, see runDiffusion
+static double gridTimestep(const DiffusionConfig &config, const GridSetup &grid)
+{
+ if (grid.start && grid.start->header.step>0) return grid.start->header.timestep;
+ return gridTimestep(config, grid.dCoeff, grid.xLen, grid.yLen, grid.zLen, !grid.quiet);
+}
+
+//seconds at the end of step for a run at dt: on from the checkpoint's time
+//when it's resumed, so that's carried over as it was saved
+static double stepTime(const GridSetup &grid, long long step, double dt)
+{
+ if (!grid.start || grid.start->header.step<=0) return step*dt;
+ return grid.start->header.time + (step - grid.start->header.step)*dt;
+}
+
+//the deterministic grid solvers. Two buffers: swapped every step for the
+//explicit solver, the second one holds the ADI delta.
+
+//Real is the type the grid is stored as: double, or float for
+//floatStorage. Float grids are only turned into doubles for the history,
+//snapshots, checkpoints and finalConc, so those only get the steps that
+//are printed or saved.
+template <typename Real>
+static void runGridSolver(const DiffusionConfig &config, const GridSetup &grid,
+ SnapshotHistory &history, std::vector<double> *finalConc)
+{
+ const bool isDouble = std::is_same<Real, double>::value;
+ const int nx = grid.nx, ny = grid.ny, nz = grid.nz;
+ const double D = grid.dCoeff;
+ std::vector<Real> concCur(grid.cells), concNext(grid.cells);
+ std::vector<double> adiWork(2*(nx+ny+nz));
+ SlabPool pool(grid.nThreads);
+ //concs as doubles, for starting from and for saving a float grid
+ std::vector<double> concOut(grid.cells);
+ startConc(grid, &concOut[0]);
+ std::copy(concOut.begin(), concOut.end(), concCur.begin());
+ std::copy(concOut.begin(), concOut.end(), concNext.begin());
+
+ const double dt = gridTimestep(config, grid);
+ double rx = D*dt/(grid.xLen*grid.xLen);
+ double ry = D*dt/(grid.yLen*grid.yLen);
+ double rz = D*dt/(grid.zLen*grid.zLen);
+
+ ActiveFront front(nx, ny, nz, config.frontThreshold*grid.maxConc);
+ UptakeObservables uptake(nx, ny, nz, grid.elemVol, &concOut[0]);
+ int firstStep = 1;
+ if (grid.start && grid.start->header.step>0) {
+  firstStep = grid.start->header.step+1;
+  restoreUptake(*grid.start, uptake);
+  if (grid.start->header.version>=2 && grid.start->live.size()==front.live.size()) {
+   front.restore(&grid.start->live[0], &grid.start->wet[0]);
+  }
+  else front.restore(0, 0);
+ }
+ //a new phase: there's water all through
+ else if (grid.start) front.restore(0, 0);
+ CheckpointWriter checkpoints(config.checkpointEvery, config.checkpointFile,
+                              seriesOnDisk(config, grid));
+ const bool saving = config.historySteps>0 || config.snapshotEvery>0 || config.checkpointEvery>0 ||
+                     config.plotQueue || finalConc;
+ if (isDouble || !saving) std::vector<double>().swap(concOut);
+ //the concs at the end of a step as doubles
+ auto doubleConc = [&]() -> const double* {
+  if (isDouble) return (const double*)&concCur[0];
+  std::copy(concCur.begin(), concCur.end(), concOut.begin());
+  return &concOut[0];
+ };
+ const int totTime = config.totTime;
+ const int printEvery = totTime>50 ? totTime/50 : 1;
+ //both grids bigger than ~32MB, i.e. more than a cache's worth, unless
+ //the front's skipping tiles instead (runDiffusion won't have both)
+ int tileSteps = config.tileSteps;
+ if (tileSteps<=0) tileSteps = grid.cells>(1L<<21) && config.frontThreshold<=0 ? 4 : 1;
+ auto outputStep = [&](int step) {
+  return step%printEvery==0 || step==totTime ||
+         (config.snapshotEvery>0 && step%config.snapshotEvery==0) ||
+         (config.plotQueue && step%grid.plotEvery==0) || checkpoints.due(step);
+ };
+ //link fluxes for each step of a block, and at the end of an ADI step
+ std::vector<double> stepFlux(6*std::max(tileSteps, 1)), endFlux(6);
+ for (int timePassed=firstStep; timePassed<=totTime; timePassed++) {
+  if (config.solverMode==kImplicitADI) {
+   //ADI is only run on double grids, see runDiffusion
+   double *conc = (double*)&concCur[0];
+   double theta = timePassed<=2 ? 1 : 0.5;
+   double startFlux[6], totalChange;
+   uptake.linkFlux(conc, rx, ry, rz, startFlux);
+   adiStep(conc, (double*)&concNext[0], nx, ny, nz, rx, ry, rz, theta, &adiWork[0], pool, 0,
+           &totalChange);
+   uptake.linkFlux(conc, rx, ry, rz, &endFlux[0]);
+   adiStepFlux(startFlux, &endFlux[0], theta, totalChange, &stepFlux[0]);
+   uptake.addStep(timePassed, stepTime(grid, timePassed, dt), &stepFlux[0]);
+  }
+  else if (tileSteps>1) {
+   //as many steps as there are before the next one that's printed or saved
+   int block = 1;
+   while (block<tileSteps && !outputStep(timePassed+block-1)) block++;
+   stencilStepsTiled(&concCur[0], &concNext[0], nx, ny, nz, rx, ry, rz, block, pool,
+                     &stepFlux[0]);
+   concCur.swap(concNext);
+   for (int t=0; t<block; t++) {
+    uptake.addStep(timePassed+t, stepTime(grid, timePassed+t, dt), &stepFlux[6*t]);
+   }
+   timePassed += block-1;
+  }
+  else {
+   if (config.frontThreshold>0) {
+    stencilStepActive(&concCur[0], &concNext[0], nx, ny, nz, rx, ry, rz, front, pool,
+                      &stepFlux[0]);
+   }
+   else stencilStep(&concCur[0], &concNext[0], nx, ny, nz, rx, ry, rz, pool, &stepFlux[0]);
+   concCur.swap(concNext);
+   uptake.addStep(timePassed, stepTime(grid, timePassed, dt), &stepFlux[0]);
+  }
+  const double timeNow = stepTime(grid, timePassed, dt);
+  if (saving && (isDouble || outputStep(timePassed))) {
+   const double *conc = doubleConc();
+   history.record(timePassed, timeNow, conc);
+   if (checkpoints.due(timePassed)) {
+    checkpoints.save(checkpointHeader(config, grid, timePassed, timeNow, dt), conc, grid.cells,
+                     config.solverMode==kExplicitStencil ? &front : 0, &uptake);
+   }
+  }
+  if (!grid.quiet && (timePassed%printEvery==0 || timePassed==totTime)) {
+   cout << "time passed:" << timeNow << " s element conc:" << concCur[grid.centreElem] << endl;
+  }
+ }
+ if (!grid.quiet) reportUptake(config, uptake, &concCur[0]);
+ if (finalConc) {
+  const double *conc = doubleConc();
+  finalConc->assign(conc, conc+grid.cells);
+ }
+}
+
+//the explicit stencil with D per face, worked out again every step from
+//the temperature in the schedule (Arrhenius, D = dCoeff at refTemperature)
+//and, with concCoeff, from the conc in the elems either side. dt stays at
+//what's stable for the biggest D the run can get to.
+static void runVariableStencil(const DiffusionConfig &config, const GridSetup &grid,
+ SnapshotHistory &history, std::vector<double> *finalConc)
+{
+ const int nx = grid.nx, ny = grid.ny, nz = grid.nz;
+ std::vector<double> concCur(grid.cells), concNext(grid.cells);
+ startConc(grid, &concCur[0]);
+ concNext = concCur;
+ SlabPool pool(grid.nThreads);
+
+ //conc never gets over the biggest it starts at, fixed layers included
+ const TemperatureSchedule &schedule = grid.temperatures;
+ const double satConc = waterLayerConc(config);
+ const double biggestConc = *std::max_element(concCur.begin(), concCur.end());
+ const double hottest = schedule.time.empty() ? config.refTemperature : schedule.hottest();
+ GridSetup fastest = grid;
+ fastest.dCoeff = grid.dCoeff*arrheniusFactor(config.activationEnergy, config.refTemperature, hottest)*
+                  exp(std::max(config.concCoeff*biggestConc/satConc, 0.0));
+ const double dt = gridTimestep(config, fastest);
+ const double sx = dt/(grid.xLen*grid.xLen);
+ const double sy = dt/(grid.yLen*grid.yLen);
+ const double sz = dt/(grid.zLen*grid.zLen);
+
+ UptakeObservables uptake(nx, ny, nz, grid.elemVol, &concCur[0]);
+ const int firstStep = grid.start && grid.start->header.step>0 ? grid.start->header.step+1 : 1;
+ if (firstStep>1) restoreUptake(*grid.start, uptake);
+ CheckpointWriter checkpoints(config.checkpointEvery, config.checkpointFile,
+                              seriesOnDisk(config, grid));
+ FaceCoeffs faces(grid.cells);
+ std::vector<double> cellD(config.concCoeff!=0 ? grid.cells : 0);
+ double *cellDOut = cellD.data();
+ const double concCoeff = config.concCoeff/satConc;
+ double dScale = -1;
+ double flux[6];
+ const int totTime = config.totTime;
+ const int printEvery = totTime>50 ? totTime/50 : 1;
+ for (int timePassed=firstStep; timePassed<=totTime; timePassed++) {
+  const double kelvin = schedule.time.empty() ? config.refTemperature :
+                        schedule.at(stepTime(grid, timePassed-1, dt));
+  const double scale = grid.dCoeff*arrheniusFactor(config.activationEnergy, config.refTemperature, kelvin);
+  if (cellDOut) {
+   const double *conc = &concCur[0];
+   pool.run(nz, [=](int k) {
+    const long first = (long)nx*ny*k, last = first + (long)nx*ny;
+    for (long e=first; e<last; e++) cellDOut[e] = exp(concCoeff*conc[e]);
+   });
+   setFaceCoeffs(cellDOut, scale, nx, ny, nz, sx, sy, sz, faces, pool);
+  }
+  //D only changes with the temperature
+  else if (scale!=dScale) setFaceCoeffs(0, scale, nx, ny, nz, sx, sy, sz, faces, pool);
+  dScale = scale;
+  variableStencilStep(&concCur[0], &concNext[0], nx, ny, nz, faces, pool, flux);
+  concCur.swap(concNext);
+  const double timeNow = stepTime(grid, timePassed, dt);
+  uptake.addStep(timePassed, timeNow, flux);
+  history.record(timePassed, timeNow, &concCur[0]);
+  if (checkpoints.due(timePassed)) {
+   checkpoints.save(checkpointHeader(config, grid, timePassed, timeNow, dt), &concCur[0], grid.cells,
+                    0, &uptake);
+  }
+  if (timePassed%printEvery==0 || timePassed==totTime) {
+   cout << "time passed:" << timeNow << " s element conc:" << concCur[grid.centreElem]
+        << " at " << kelvin << " K" << endl;
+  }
+ }
+ reportUptake(config, uptake, &concCur[0]);
+ if (finalConc) finalConc->swap(concCur);
+}
+
+//the explicit stencil on a float grid. With compareDouble it's run on a
+//double grid as well, and the final concs compared.
+static void runFloatStencil(const DiffusionConfig &config, const GridSetup &grid,
+ SnapshotHistory &history, std::vector<double> *finalConc)
+{
+ if (!config.compareDouble) {
+  runGridSolver<float>(config, grid, history, finalConc);
+  return;
+ }
+ std::vector<double> floatConc, doubleConc;
+ runGridSolver<float>(config, grid, history, &floatConc);
+ //same again quietly, without saving anything
+ DiffusionConfig doubleConfig = config;
+ doubleConfig.snapshotEvery = 0;
+ doubleConfig.checkpointEvery = 0;
+ doubleConfig.observablesFile = 0;
+ doubleConfig.historySteps = 0;
+ doubleConfig.plotQueue = 0;
+ GridSetup doubleGrid = grid;
+ doubleGrid.quiet = true;
+ SnapshotHistory noHistory(grid.cells, grid.nx, grid.ny, grid.nz, 0, 0, 0);
+ runGridSolver<double>(doubleConfig, doubleGrid, noHistory, &doubleConc);
+
+ double maxError = 0, floatMoles = 0, doubleMoles = 0;
+ for (long e=0; e<grid.cells; e++) {
+  if (grid.elemLabel[e]!=kAcrylic) continue;
+  maxError = std::max(maxError, fabs(floatConc[e]-doubleConc[e]));
+  floatMoles += floatConc[e];
+  doubleMoles += doubleConc[e];
+ }
+ cout << "float storage: biggest conc error " << maxError/grid.maxConc << " of max conc, "
+      << "water taken up off by " << (floatMoles-doubleMoles)/doubleMoles << endl;
+ if (finalConc) finalConc->swap(floatConc);
+}
+
+//bulk version of the walk. Keeps whole n.o. molecule groups per element
+//instead of concs, so nothing is lost rounding every step; a group is
+//1/(elemVol*fakeAvoNum) of conc.
+template <int N>
+static void runMultinomialWalk(const DiffusionConfig &config, const GridSetup &grid,
+ SnapshotHistory &history, std::vector<double> *finalConc)
+{
+ const int nx = grid.nx, ny = grid.ny, nz = grid.nz;
+ const double grpPerConc = grid.elemVol*config.fakeAvoNum;
+ const NeighbourMoves<N> moves(nx, ny);
+ std::vector<long long> grpCur(grid.cells, 0LL), grpNext(grid.cells);
+ std::vector<double> concNow(grid.cells);
+ const long long holderGrp = llround(grid.holderConc*grpPerConc);
+ const long long waterGrp = llround(grid.maxConc*grpPerConc);
+ if (grid.start) {
+  //concs are whole groups over grpPerConc, so this gets the groups back exactly
+  for (long e=0; e<grid.cells; e++) grpCur[e] = llround(grid.start->conc[e]*grpPerConc);
+ }
+ applyFixedElems(&grpCur[0], grid.outerElems, holderGrp);
+ applyFixedElems(&grpCur[0], grid.waterElems, waterGrp);
+ SlabPool pool(grid.nThreads);
+ CheckpointWriter checkpoints(config.checkpointEvery, config.checkpointFile);
+
+ const int firstStep = grid.start ? grid.start->header.step+1 : 1;
+ for (int timePassed=firstStep; timePassed<=config.totTime; timePassed++) {
+  multinomialStep(&grpCur[0], &grpNext[0], nx, ny, nz, moves, config.walkSeed,
+                  timePassed, pool);
+  applyFixedElems(&grpNext[0], grid.outerElems, holderGrp);
+  applyFixedElems(&grpNext[0], grid.waterElems, waterGrp);
+  grpCur.swap(grpNext);
+  for (long e=0; e<grid.cells; e++) concNow[e] = grpCur[e]/grpPerConc;
+  history.record(timePassed, timePassed, &concNow[0]);
+  cout << "time passed:" << timePassed << " element conc:" << grpCur[grid.centreElem]/grpPerConc << endl;
+  if (checkpoints.due(timePassed)) {
+   checkpoints.save(checkpointHeader(config, grid, timePassed, timePassed, 0), &concNow[0], grid.cells,
+                   0, 0);
+  }
+ }
+ if (finalConc) finalConc->swap(concNow);
+}
+
+//the original walk, one random move per leader molecule.
+//imagine having 'leader' molecules and 'follower' molecules
+//wherever the leader molecules go, their group follows...
+//fakeAvoNum is the number of leader molecules, and 10^23/fakeAvoNum = follower molecules 
+//need to implement this cause can't loop for 10^23 times.
+template <int N>
+static void runMoleculeWalk(const DiffusionConfig &config, const GridSetup &grid,
+ SnapshotHistory &history, std::vector<double> *finalConc)
+{
+ const double elemVol = grid.elemVol, fakeAvoNum = config.fakeAvoNum;
+ const double truAvoNum = pow(10,23); //the real magnitude of Avogadro's number.
+ const double followerMolecules = truAvoNum/fakeAvoNum; //number of followers
+ const NeighbourMoves<N> moves(grid.nx, grid.ny); //the moves they can choose from
+ std::vector<double> elemConc(grid.cells); //array for current conc in each element
+                                          //each element is defined by its position
+ long long moleculeGrpInCube; //number of molecule groups led by 'leaders' followed by 'followers' in elem0
+ long chosenElem; //the elem that the lead (and so the follower) molecules 'choose' to go into
+
+ //need to reset the concentrations for the 1st and 2nd layers always.
+ //1st layer=holderConc, 2nd layer=maxConc.
+ //all of inside starts at conc=0. Which elems those are comes from the
+ //lists made once by labelElems, so this is only the surface every step.
+ if (grid.start) elemConc = grid.start->conc;
+ CheckpointWriter checkpoints(config.checkpointEvery, config.checkpointFile);
+ const int firstStep = grid.start ? grid.start->header.step+1 : 1;
+ for (int timePassed=firstStep; timePassed<=config.totTime; timePassed++) {
+  applyFixedElems(&elemConc[0], grid.outerElems, grid.holderConc);
+  applyFixedElems(&elemConc[0], grid.waterElems, grid.maxConc);
+
+  for (long elemCount=0; elemCount<grid.cells; elemCount++) {
+   moleculeGrpInCube = (long long)(elemConc[elemCount]*elemVol*fakeAvoNum);
+   chosenElem=elemCount; //reset every element count loop. 
+
+   //make random walk occur for all layers but the first; just reset the
+   //2nd layer every timestep
+   if (grid.elemLabel[elemCount]!=kOuterFace) {
+    for (long long moleculeCount=1; moleculeCount<=moleculeGrpInCube; moleculeCount++) {
+/* need to know position of the 26 surrounding cube elements. will name it 
+   by the number scheme as above, with elements labelled 0 to 26.
+   The central cube number is 13                   
+   
+   slices of a front-facing cube:
+   
+   1st             2nd             3rd
+   -----------     ------------    -----------
+   |6   7   8|     |15  16  17|    |24  25  26|
+   |3   4   5|     |12  13  14|    |21  22  23|
+   |0   1   2|     |9   10  11|    |18  19  20|
+   -----------     ------------    ------------
+
+   Neighbourhood<27> holds the offsets for these numbers: cube 4 (front) is
+   elemCount-nx*ny, cube 10 (bot) elemCount-nx, cube 12 (left) elemCount-1,
+   and so on. With 19 moves the corners (0,2,6,8,18,20,24,26) are left out.
+*/
+     //one Philox draw per molecule, counter = (timestep, elem, molecule),
+     //the molecule's top 32 bits going in the last counter word
+     CounterRng rng(config.walkSeed, timePassed, elemCount, (unsigned int)moleculeCount,
+                    (unsigned int)(moleculeCount>>32));
+     int r = (rng.uniform())*N;
+
+     //the move table matches the random number to the cube it moves to.
+     //Only elems inside the outer face walk, so every move stays on the grid.
+     chosenElem = moves.move(elemCount, r);
+
+     //for the chosen elem, update conc. The whole grid goes into the
+     //history at the end of the timestep.
+     elemConc[chosenElem]= (elemConc[chosenElem]*elemVol*truAvoNum+followerMolecules)/(elemVol*truAvoNum);
+     //adjust elem13 accordingly 
+     elemConc[elemCount]= (elemConc[elemCount]*elemVol*truAvoNum-followerMolecules)/(elemVol*truAvoNum);
+     //the formula above should work for r==13 as well; we get a net 0.
+    } //end bracket for the molecule count per elem 
+   }
+
+   if (elemCount==grid.centreElem) { 
+    cout << "time passed:" << timePassed << " element conc:" << elemConc[elemCount] <<endl;  
+   }     
+  } //end bracket for the elem count
+
+  history.record(timePassed, timePassed, &elemConc[0]);
+  if (checkpoints.due(timePassed)) {
+   checkpoints.save(checkpointHeader(config, grid, timePassed, timePassed, 0), &elemConc[0], grid.cells,
+                   0, 0);
+  }
+ } // end bracket for total time                 
+ if (finalConc) finalConc->swap(elemConc);
+}
+
+//both walks, with the neighbourhood as a template parameter so the move
+//tables are still built at compile time
+template <int N>
+static void runWalk(const DiffusionConfig &config, const GridSetup &grid,
+ SnapshotHistory &history, std::vector<double> *finalConc)
+{
+ if (config.solverMode==kMultinomialWalk) runMultinomialWalk<N>(config, grid, history, finalConc);
+ else runMoleculeWalk<N>(config, grid, history, finalConc);
+}
+
+//the box kAnalytic works on along one axis: its length, and where the
+//centre elem is in it as a fraction. With analyticGridLengths that's the
+//(n-3) elems between the centres of the two water layers, which is what
+//the grid solvers see; otherwise it's the whole piece.
+static void analyticAxis(const DiffusionConfig &config, int n, double h, double totLen,
+ double &len, double &centre)
+{
+ if (config.analyticGridLengths) {
+  len = (n-3)*h;
+  centre = (n/2 - 1.0)/(n-3);
+ }
+ else {
+  len = totLen;
+  centre = (n/2 + 0.5)/n;
+ }
+}
+
+//runs config.validateSolver on the grid and compares its final concs with
+//the series for the same time. Every solver is Fickian in the acrylic, with
+//D*dt/h^2 along each axis per step of r for the grid solvers and of the
+//walk's mean squared step over 2 for the walks (1/3 for 27 moves, 5/19
+//for 19 and 1/7 for 7), so tau is that*steps/(n-3)^2.
+static void validateAnalytic(const DiffusionConfig &config, const GridSetup &grid)
+{
+ DiffusionConfig runConfig = config;
+ runConfig.solverMode = config.validateSolver;
+ runConfig.historySteps = 0;
+ runConfig.snapshotEvery = 0;
+ runConfig.checkpointEvery = 0;
+ runConfig.observablesFile = 0;
+ runConfig.plotQueue = 0;
+ SnapshotHistory noHistory(grid.cells, grid.nx, grid.ny, grid.nz, 0, 0, 0);
+ std::vector<double> conc;
+ double stepR[3];
+ const double h[3] = {grid.xLen, grid.yLen, grid.zLen};
+ if (runConfig.solverMode==kExplicitStencil || runConfig.solverMode==kImplicitADI) {
+  const double dt = gridTimestep(runConfig, grid);
+  for (int a=0; a<3; a++) stepR[a] = grid.dCoeff*dt/(h[a]*h[a]);
+  runGridSolver<double>(runConfig, grid, noHistory, &conc);
+ }
+ else {
+  const int N = config.walkNeighbours;
+  for (int a=0; a<3; a++) stepR[a] = N==27 ? 1.0/3 : (N==19 ? 5.0/19 : 1.0/7);
+  if (N==7) runWalk<7>(runConfig, grid, noHistory, &conc);
+  else if (N==19) runWalk<19>(runConfig, grid, noHistory, &conc);
+  else runWalk<27>(runConfig, grid, noHistory, &conc);
+ }
+
+ //the series at every elem centre, one axis at a time
+ const int n[3] = {grid.nx, grid.ny, grid.nz};
+ std::vector<double> series[3];
+ double seriesMean[3];
+ for (int a=0; a<3; a++) {
+  const double tau = stepR[a]*config.totTime/((n[a]-3.0)*(n[a]-3.0));
+  series[a].resize(n[a]);
+  seriesMean[a] = 0;
+  for (int q=2; q<n[a]-2; q++) {
+   series[a][q] = concSeries((q-1.0)/(n[a]-3), tau);
+   seriesMean[a] += series[a][q]/(n[a]-4);
+  }
+ }
+ double worst = 0, gridMean = 0;
+ long acrylicElems = 0;
+ for (int k=2; k<grid.nz-2; k++) {
+  for (int j=2; j<grid.ny-2; j++) {
+   for (int i=2; i<grid.nx-2; i++) {
+    const long elem = i + (long)grid.nx*j + (long)grid.nx*grid.ny*k;
+    const double exact = grid.maxConc*(1 - series[0][i]*series[1][j]*series[2][k]);
+    worst = std::max(worst, fabs(conc[elem]-exact));
+    gridMean += conc[elem];
+    acrylicElems++;
+   }
+  }
+ }
+ gridMean /= acrylicElems*grid.maxConc;
+ const double exactCentre = grid.maxConc*(1 - series[0][grid.nx/2]*series[1][grid.ny/2]*series[2][grid.nz/2]);
+ cout << "series vs solver " << runConfig.solverMode << " after " << config.totTime << " steps:"
+      << " centre conc " << exactCentre << " vs " << conc[grid.centreElem]
+      << ", uptake fraction " << 1 - seriesMean[0]*seriesMean[1]*seriesMean[2] << " vs " << gridMean
+      << ", biggest conc difference " << worst/grid.maxConc << " of max conc" << endl;
+}
+
+//the box from the Fourier series instead of a grid: the conc at the centre
+//elem and the uptake at the same steps the explicit stencil would print, and
+//when water from sourceFace would get through with the other faces sealed
+static void runAnalytic(const DiffusionConfig &config, const GridSetup &grid,
+ std::vector<double> *finalConc)
+{
+ if (config.validateSolver>=0) {
+  validateAnalytic(config, grid);
+  return;
+ }
+ const int n[3] = {grid.nx, grid.ny, grid.nz};
+ const double h[3] = {grid.xLen, grid.yLen, grid.zLen};
+ const double totLen[3] = {config.xTotLen, config.yTotLen, config.zTotLen};
+ double len[3], centre[3];
+ for (int a=0; a<3; a++) analyticAxis(config, n[a], h[a], totLen[a], len[a], centre[a]);
+ const double D = grid.dCoeff, maxConc = grid.maxConc;
+ const double dt = gridTimestep(config, grid);
+ const int totTime = config.totTime;
+ const int printEvery = totTime>50 ? totTime/50 : 1;
+ for (int step=printEvery; step<=totTime; step+=printEvery) {
+  const double t = step*dt;
+  cout << "time passed:" << t << " s element conc:"
+       << maxConc*boxConcFraction(centre[0], centre[1], centre[2], D*t/(len[0]*len[0]),
+                                  D*t/(len[1]*len[1]), D*t/(len[2]*len[2])) << endl;
+ }
+ const double t = totTime*dt;
+ const double tau[3] = {D*t/(len[0]*len[0]), D*t/(len[1]*len[1]), D*t/(len[2]*len[2])};
+ double takenUp = maxConc*len[0]*len[1]*len[2]*boxUptakeFraction(tau[0], tau[1], tau[2]);
+ if (config.analyticGridLengths) {
+  //what the grid solvers count: the (n-4) acrylic elems along each axis,
+  //each at its centre, not the whole (n-3) elem box
+  double acrylicVol = grid.elemVol, dryFraction = 1;
+  for (int a=0; a<3; a++) {
+   double mean = 0;
+   for (int q=2; q<n[a]-2; q++) mean += concSeries((q-1.0)/(n[a]-3), tau[a])/(n[a]-4);
+   dryFraction *= mean;
+   acrylicVol *= n[a]-4;
+  }
+  takenUp = maxConc*acrylicVol*(1 - dryFraction);
+ }
+ cout << "water taken up:" << takenUp << " moles" << endl;
+
+ //one wet face and the far one sealed is a slab; on the grid the sealed
+ //face is half an elem past the last acrylic elem
+ const int axis = config.sourceFace/2;
+ const double slabLen = config.analyticGridLengths ? (n[axis]-3.5)*h[axis] : totLen[axis];
+ const double farPos = config.analyticGridLengths ? (n[axis]-4)/(n[axis]-3.5) : 1;
+ const double tauThrough = slabBreakthroughTau(farPos, config.breakthroughFrac);
+ if (tauThrough>0) {
+  const double crossTime = tauThrough*slabLen*slabLen/D;
+  cout << "breakthrough after " << crossTime << " s (" << crossTime/86400 << " days)" << endl;
+ }
+
+ if (finalConc) {
+  //the series is a product of one per axis, so work those out per elem
+  //position once
+  std::vector<double> series[3];
+  for (int a=0; a<3; a++) {
+   series[a].assign(n[a], 0.0);
+   for (int q=2; q<n[a]-2; q++) {
+    const double f = config.analyticGridLengths ? (q-1.0)/(n[a]-3) : (q+0.5)/n[a];
+    series[a][q] = concSeries(f, tau[a]);
+   }
+  }
+  finalConc->assign(grid.cells, 0.0);
+  double *conc = finalConc->data();
+  applyFixedElems(conc, grid.outerElems, grid.holderConc);
+  applyFixedElems(conc, grid.waterElems, maxConc);
+  for (int k=2; k<n[2]-2; k++) {
+   for (int j=2; j<n[1]-2; j++) {
+    for (int i=2; i<n[0]-2; i++) {
+     conc[i + (long)n[0]*j + (long)n[0]*n[1]*k] = maxConc*(1 - series[0][i]*series[1][j]*series[2][k]);
+    }
+   }
+  }
+ }
+}
+
+int runDiffusion(const DiffusionConfig &config, std::vector<double> *finalConc)
+{
+ if (config.nx<5 || config.ny<5 || config.nz<5) {
+  cout << "need at least 5 divisions along each axis, not " << config.nx << "x"
+       << config.ny << "x" << config.nz << endl;
+  return 1;
+ }
+ if (config.solverMode<kRandomWalk || config.solverMode>kVariableStencil) {
+  cout << "no solver mode " << config.solverMode << endl;
+  return 1;
+ }
+ if (config.walkNeighbours!=7 && config.walkNeighbours!=19 && config.walkNeighbours!=27) {
+  cout << "walkNeighbours must be 7, 19 or 27, not " << config.walkNeighbours << endl;
+  return 1;
+ }
+ if (config.solverMode==kAnalytic && (config.validateSolver==kBreakthrough ||
+     config.validateSolver>=kAnalytic)) {
+  cout << "the series can only check the walks, stencil and ADI" << endl;
+  return 1;
+ }
+ if ((config.temperatureFile || config.concCoeff!=0) && config.solverMode!=kVariableStencil) {
+  cout << "temperature schedules and conc dependent D are only for the variable stencil" << endl;
+  return 1;
+ }
+ if (config.tileSteps>1 && config.frontThreshold>0 && config.solverMode==kExplicitStencil) {
+  cout << "the active front takes one step at a time, it can't be tiled" << endl;
+  return 1;
+ }
+ if (config.floatStorage && config.solverMode!=kExplicitStencil) {
+  cout << "float storage is only for the explicit stencil" << endl;
+  return 1;
+ }
+ if (config.sourceFace<kFaceXLow || config.sourceFace>kFaceZHigh) {
+  cout << "no face " << config.sourceFace << endl;
+  return 1;
+ }
+
+ GridSetup grid;
+ grid.nx = config.nx; grid.ny = config.ny; grid.nz = config.nz;
+ grid.cells = (long)grid.nx*grid.ny*grid.nz;
+ grid.xLen = config.xTotLen/grid.nx;
+ grid.yLen = config.yTotLen/grid.ny;
+ grid.zLen = config.zTotLen/grid.nz;
+ grid.elemVol = grid.xLen*grid.yLen*grid.zLen;
+ grid.maxConc = config.drying ? 0 : waterLayerConc(config);
+ grid.holderConc = config.drying ? 0 : config.holderConc;
+ grid.dCoeff = config.drying && config.dCoeffAir>0 ? config.dCoeffAir : config.dCoeff;
+ grid.centreElem = grid.nx/2 + (long)grid.nx*(grid.ny/2) + (long)grid.nx*grid.ny*(grid.nz/2);
+ grid.nThreads = config.nThreads>0 ? config.nThreads : (int)std::thread::hardware_concurrency();
+
+ //outer face / water layer / acrylic for every elem, and the lists of
+ //fixed elems, shared by all the solvers
+ grid.elemLabel.resize(grid.cells);
+ labelElems(&grid.elemLabel[0], grid.nx, grid.ny, grid.nz, grid.outerElems, grid.waterElems);
+
+ //carrying on from a checkpoint, or a new phase starting from one
+ Checkpoint start;
+ grid.start = 0;
+ grid.quiet = false;
+ grid.plotEvery = config.plotEvery>0 ? config.plotEvery : std::max(config.totTime/50, 1);
+ if (config.temperatureFile && readTemperatureSchedule(config.temperatureFile, grid.temperatures)!=0) {
+  return 1;
+ }
+ const char *startFile = config.resumeFile ? config.resumeFile : config.startFrom;
+ if (startFile) {
+  if (config.resumeFile && config.startFrom) {
+   cout << "resume a run or start a new phase, not both" << endl;
+   return 1;
+  }
+  if (config.solverMode==kBreakthrough || config.solverMode==kAnalytic) {
+   cout << "breakthrough and analytic runs can't start from a checkpoint" << endl;
+   return 1;
+  }
+  if (!readCheckpoint(startFile, start)) {
+   cout << "can't read checkpoint " << startFile << endl;
+   return 1;
+  }
+  if (start.header.nx!=grid.nx || start.header.ny!=grid.ny || start.header.nz!=grid.nz) {
+   cout << "checkpoint " << startFile << " is for a " << start.header.nx << "x" << start.header.ny
+        << "x" << start.header.nz << " grid" << endl;
+   return 1;
+  }
+  if (config.resumeFile && (start.header.solverMode!=config.solverMode ||
+      start.header.walkSeed!=config.walkSeed || start.header.walkNeighbours!=config.walkNeighbours)) {
+   cout << "checkpoint " << startFile << " is from a different solver, seed or neighbourhood" << endl;
+   return 1;
+  }
+  if (config.resumeFile && start.header.version<3) {
+   cout << "checkpoint " << startFile << " doesn't have the dt it ran at, use --start-from" << endl;
+   return 1;
+  }
+  //carrying on has to be the same physics as the run that saved it, or the
+  //times and the uptake stop making sense. The walks have no dt; the grid
+  //solvers carry on at the checkpoint's (see gridTimestep), so --dt only
+  //has to be what the saved run asked for or got.
+  if (config.resumeFile) {
+   const CheckpointHeader &saved = start.header;
+   const bool walk = config.solverMode==kRandomWalk || config.solverMode==kMultinomialWalk;
+   const double askedDt = config.timestep;
+   std::string changed;
+   if (!walk && askedDt>0 && askedDt!=saved.timestep && askedDt!=saved.timestepAsked) changed += " dt";
+   if (saved.xTotLen!=config.xTotLen || saved.yTotLen!=config.yTotLen || saved.zTotLen!=config.zTotLen) {
+    changed += " lengths";
+   }
+   if (saved.dCoeff!=grid.dCoeff) changed += " D";
+   if (saved.maxConc!=grid.maxConc) changed += " maxConc";
+   if (saved.holderConc!=grid.holderConc) changed += " holderConc";
+   if (walk && saved.fakeAvoNum!=config.fakeAvoNum) changed += " fakeAvoNum";
+   if (!changed.empty()) {
+    cout << "checkpoint " << startFile << " was saved with a different" << changed
+         << "; --start-from starts a new phase from its concs" << endl;
+    return 1;
+   }
+  }
+  cout << (config.resumeFile ? "resuming from step " : "starting from the concs at step ")
+       << start.header.step << " of " << startFile << endl;
+  if (config.startFrom) {
+   //only the concs carry over to a new phase
+   start.header.step = 0;
+   start.header.time = 0;
+   start.live.clear();
+   start.wet.clear();
+   start.series.clear();
+  }
+  grid.start = &start;
+ }
+
+ //the last few steps in memory, full snapshots streamed to disk
+ SnapshotHistory history(grid.cells, grid.nx, grid.ny, grid.nz, config.historySteps,
+                         config.snapshotEvery, config.snapshotFile);
+ if (config.plotQueue) history.publishTo(config.plotQueue, grid.plotEvery);
+
+ switch (config.solverMode) {
+  case kBreakthrough:
+   runBreakthrough(config, grid, history, finalConc);
+   break;
+  case kExplicitStencil:
+   if (config.floatStorage) runFloatStencil(config, grid, history, finalConc);
+   else runGridSolver<double>(config, grid, history, finalConc);
+   break;
+  case kImplicitADI:
+   runGridSolver<double>(config, grid, history, finalConc);
+   break;
+  case kAnalytic:
+   runAnalytic(config, grid, finalConc);
+   break;
+  case kVariableStencil:
+   runVariableStencil(config, grid, history, finalConc);
+   break;
+  default:
+   if (config.walkNeighbours==7) runWalk<7>(config, grid, history, finalConc);
+   else if (config.walkNeighbours==19) runWalk<19>(config, grid, history, finalConc);
+   else runWalk<27>(config, grid, history, finalConc);
+ }
+ return 0;
+}
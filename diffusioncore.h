@@ -0,0 +1,1393 @@
+/*core of the SNO+ 3D diffusion model for water in acrylic, with no ROOT
+  in it. Everything needed to set up a grid and run any of the solvers on
+  it; built into libdiffusioncore (see the Makefile) and used by the
+  command line driver diffusioncli.c and by the ROOT macro
+  diffusionmodel3dnewarray.c, which has the description of the geometry
+  and the layers.
+*/
+#ifndef DIFFUSIONCORE_H
+#define DIFFUSIONCORE_H
+
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+//which model to run. kRandomWalk is the original leader/follower molecule
+//walk; kExplicitStencil solves Fick's law deterministically on the grid;
+//kImplicitADI does the same but implicitly, so dt isn't limited by stability;
+//kMultinomialWalk is the random walk done per element instead of per molecule;
+//kBreakthrough runs ADI from one wet face until water reaches the other side;
+//kAnalytic works the same box out from the Fourier series, no grid;
+//kVariableStencil is the explicit stencil with D changing with the
+//temperature over time and with the conc from elem to elem.
+enum ESolverMode { kRandomWalk=0, kExplicitStencil=1, kImplicitADI=2,
+                   kMultinomialWalk=3, kBreakthrough=4, kAnalytic=5,
+                   kVariableStencil=6 };
+
+/*counter based PRNG, Philox4x32-10 (Salmon et al., "Parallel random numbers:
+  as easy as 1, 2, 3", SC11). Every random number is a pure function of the
+  key (the seed) and a 128 bit counter, which we fill with (timestep, elem,
+  molecule/draw n.o., stream). So there is no generator state to share or
+  reseed, elems can be done in any order or on any thread, and a given seed
+  always gives the same run.
+ function name: philox4x32
+ param1: the counter, 4 words
+ param2: the key, 2 words
+ param3: 4 random words (output)
+*/
+inline void philox4x32(const unsigned int ctr[4], const unsigned int key[2], unsigned int out[4])
+{
+ unsigned int c0=ctr[0], c1=ctr[1], c2=ctr[2], c3=ctr[3];
+ unsigned int k0=key[0], k1=key[1];
+ for (int round=0; round<10; round++) {
+  unsigned long long p0 = 0xD2511F53ULL*c0;
+  unsigned long long p1 = 0xCD9E8D57ULL*c2;
+  unsigned int n0 = (unsigned int)(p1>>32) ^ c1 ^ k0;
+  unsigned int n2 = (unsigned int)(p0>>32) ^ c3 ^ k1;
+  c1 = (unsigned int)p1;
+  c3 = (unsigned int)p0;
+  c0 = n0;
+  c2 = n2;
+  k0 += 0x9E3779B9U;
+  k1 += 0xBB67AE85U;
+ }
+ out[0]=c0; out[1]=c1; out[2]=c2; out[3]=c3;
+}
+
+//stream of uniforms in [0,1) for one (seed, timestep, elem, draw) counter.
+//Each Philox call gives two doubles; after that the 3rd counter word is
+//bumped so one elem can draw as many as it needs.
+struct CounterRng {
+ unsigned int key[2];
+ unsigned int ctr[4];
+ unsigned int out[4];
+ int used;
+
+ CounterRng(unsigned long long seed, unsigned int step, unsigned int elem,
+            unsigned int draw=0, unsigned int stream=0) {
+  key[0] = (unsigned int)seed;
+  key[1] = (unsigned int)(seed>>32);
+  ctr[0] = step; ctr[1] = elem; ctr[2] = draw; ctr[3] = stream;
+  used = 4;
+ }
+
+ double uniform() {
+  if (used>=4) {
+   philox4x32(ctr, key, out);
+   ctr[2]++;
+   used = 0;
+  }
+  //53 random bits out of two words
+  unsigned long long bits = ((unsigned long long)(out[used]>>5)<<26) | (out[used+1]>>6);
+  used += 2;
+  return bits*(1.0/9007199254740992.0);
+ }
+};
+
+//log(k!) - Stirling's approximation of it, for counterBinomial
+inline double stirlingTail(double k)
+{
+ static const double table[10] = {0.08106146679532726, 0.04134069595540929,
+  0.02767792568499834, 0.02079067210376509, 0.01664469118982119,
+  0.01387612882307075, 0.01189670994589177, 0.01041126526197209,
+  0.009255462182712733, 0.008330563433362871};
+ if (k<10) return table[(int)k];
+ double kp1sq = (k+1)*(k+1);
+ return (1.0/12 - (1.0/360 - 1.0/1260/kp1sq)/kp1sq)/(k+1);
+}
+
+/*binomial(n,p) random number from a CounterRng. Inversion when the mean
+  is small, otherwise Hormann's BTRD rejection method ("The generation of
+  binomial random variates", 1993), which takes ~1.2 uniforms whatever n is.
+ function name: counterBinomial
+ param1: the generator for this elem and step
+ param2: n.o. trials
+ param3: probability of each
+ output: n.o. successes
+*/
+long long counterBinomial(CounterRng &rng, long long n, double p);
+
+//elements are numbered elem = i + nx*j + nx*ny*k, with i,j,k the
+//positions along x,y and z and nx,ny,nz the n.o. divisions along each.
+//So neighbours in x are +-1, in y +-nx and in z +-nx*ny. Each of nx,ny,nz
+//must be at least 5.
+
+/*pool of worker threads that share out a sweep over the grid, one item
+  (usually a z-slab) at a time. Each thread starts with its own contiguous
+  block of items and, once that is done, steals items from the other
+  blocks, so cheap slabs near the faces and expensive ones in the middle
+  even out. The calling thread works too, so with 1 thread this is just a
+  plain loop. run() returns once every item is done.
+*/
+class SlabPool {
+ public:
+  SlabPool(int nThreads) : nThreads(nThreads<1 ? 1 : nThreads), ranges(this->nThreads),
+   generation(0), pending(0), stopping(false), work(0) {
+   for (int t=1; t<this->nThreads; t++) workers.push_back(std::thread(&SlabPool::workerLoop, this, t));
+  }
+
+  ~SlabPool() {
+   {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+   }
+   wake.notify_all();
+   for (size_t t=0; t<workers.size(); t++) workers[t].join();
+  }
+
+  int threads() const { return nThreads; }
+
+  //calls slabWork(item) for item = 0 .. nItems-1, spread over the threads
+  void run(int nItems, const std::function<void(int)> &slabWork) {
+   if (nItems<=0) return;
+   if (nThreads==1) {
+    for (int item=0; item<nItems; item++) slabWork(item);
+    return;
+   }
+   for (int t=0; t<nThreads; t++) {
+    ranges[t].next.store((int)((long)nItems*t/nThreads));
+    ranges[t].end = (int)((long)nItems*(t+1)/nThreads);
+   }
+   {
+    std::lock_guard<std::mutex> lock(mtx);
+    work = &slabWork;
+    pending = nThreads-1;
+    generation++;
+   }
+   wake.notify_all();
+   drain(0);
+   std::unique_lock<std::mutex> lock(mtx);
+   done.wait(lock, [this]{ return pending==0; });
+   work = 0;
+  }
+
+ private:
+  struct alignas(64) Range {
+   std::atomic<int> next;
+   int end;
+  };
+
+  //own block first, then go round the others taking what's left
+  void drain(int id) {
+   for (int v=0; v<nThreads; v++) {
+    Range &r = ranges[(id+v)%nThreads];
+    for (int item=r.next.fetch_add(1); item<r.end; item=r.next.fetch_add(1)) (*work)(item);
+   }
+  }
+
+  void workerLoop(int id) {
+   unsigned long seen = 0;
+   for (;;) {
+    {
+     std::unique_lock<std::mutex> lock(mtx);
+     wake.wait(lock, [&]{ return stopping || generation!=seen; });
+     if (stopping) return;
+     seen = generation;
+    }
+    drain(id);
+    std::lock_guard<std::mutex> lock(mtx);
+    if (--pending==0) done.notify_one();
+   }
+  }
+
+  int nThreads;
+  std::vector<Range> ranges;
+  std::vector<std::thread> workers;
+  std::mutex mtx;
+  std::condition_variable wake, done;
+  unsigned long generation;
+  int pending;
+  bool stopping;
+  const std::function<void(int)> *work;
+};
+
+/*this function is for calculating the new conc at each elem in the dry
+  acrylic area. So not the boundaries. Each elem is surrounded by 6
+  other cubic elems on the left, right, top, bottom, front, and back.
+  Forward Euler in time, central differences in space, i.e.
+  D*dt*(sum of neighbours - 2*theElem)/h^2 along each axis.
+ function name: cubeElemUpdate
+ param1: current conc in the elem we are interested in
+ param2: conc in the elem left to theElem   (-x)
+ param3: conc in the elem right to theElem  (+x)
+ param4: conc in the elem in front of theElem (-y)
+ param5: conc in the elem behind theElem    (+y)
+ param6: conc in the elem below theElem     (-z)
+ param7: conc in the elem above theElem     (+z)
+ param8: D*timestep/(xLen*xLen)
+ param9: D*timestep/(yLen*yLen)
+ param10: D*timestep/(zLen*zLen)
+ output: we get the new concentration in theElem, in quantity per volume
+ stable as long as param8+param9+param10 <= 0.5
+*/
+inline double cubeElemUpdate(double theElemConc, double leftElemConc,
+ double rightElemConc, double frontElemConc, double backElemConc,
+ double botElemConc, double topElemConc, double rx, double ry, double rz)
+{
+ return theElemConc + rx*(leftElemConc+rightElemConc-2*theElemConc)
+                    + ry*(frontElemConc+backElemConc-2*theElemConc)
+                    + rz*(botElemConc+topElemConc-2*theElemConc);
+}
+
+//what each element is. Worked out once at setup by labelElems.
+enum EElemLabel { kAcrylic=0, kWaterLayer=1, kOuterFace=2 };
+
+/*labels every element as outer face (1st layer), water layer (2nd layer)
+  or acrylic, and makes the lists of outer face and water layer elems so
+  the fixed concs can be put back every step without going over the whole
+  grid. Done once, O(nx*ny*nz).
+ function name: labelElems
+ param1: array of nx*ny*nz labels (output)
+ param2-4: n.o. divisions along x, y and z
+ param5: list of the outer face elems (output)
+ param6: list of the water layer elems (output)
+*/
+void labelElems(unsigned char *elemLabel, int nx, int ny, int nz,
+ std::vector<long> &outerElems, std::vector<long> &waterElems);
+
+//sets every elem in the list to value. This is how the fixed layers get
+//their concs (or molecule groups) back each step: cost goes with the
+//surface, not the volume.
+template <typename T>
+void applyFixedElems(T *elemVal, const std::vector<long> &elems, T value)
+{
+ for (size_t q=0; q<elems.size(); q++) elemVal[elems[q]] = value;
+}
+
+//the six faces of the cube, low and high end of each axis
+enum EFace { kFaceXLow=0, kFaceXHigh=1, kFaceYLow=2, kFaceYHigh=3,
+             kFaceZLow=4, kFaceZHigh=5 };
+
+/*the elems on one face at a given depth (1 = water layer, 2 = first layer
+  of acrylic, ...), over the acrylic's footprint on that face, i.e. 2 to
+  n-3 along the other two axes. The lists for two depths on the same
+  face line up elem for elem.
+ function name: faceLayerElems
+ param1-3: n.o. divisions along x, y and z
+ param4: which face, EFace
+ param5: how many elems in from the face, 0 = the face itself
+ output: list of elems
+*/
+std::vector<long> faceLayerElems(int nx, int ny, int nz, int face, int depth);
+
+//zero flux through a face: each water layer elem on the face (ghost) is
+//given the conc of the acrylic elem next to it, so there's no gradient
+//across the face
+void refreshGhosts(double *conc, const std::vector<long> &ghostElems,
+ const std::vector<long> &innerElems);
+
+/*sets up the starting grid for the stencil solver: 1st layer (the cube
+  faces) at holderConc, 2nd layer (the water layer) at maxConc, and all of
+  the acrylic inside at 0. The 1st and 2nd layers are fixed, so if both
+  buffers are set up with this they never need resetting again.
+ function name: stencilInit
+ param1: the array of concs to fill
+ param2: n.o. elems
+ param3: list of the outer face elems
+ param4: list of the water layer elems
+ param5: conc of the 1st layer
+ param6: conc of the 2nd (water) layer
+*/
+void stencilInit(double *elemConc, long cells, const std::vector<long> &outerElems,
+ const std::vector<long> &waterElems, double holderConc, double maxConc);
+
+/*one explicit timestep over the whole grid, reading cur and writing next
+  (double buffering, so the result doesn't depend on the order the elems
+  are visited in, or on how many threads there are). Only the acrylic
+  (layer 2 and in) is written. The i loop is unit stride with no branches
+  so the compiler can vectorize it. Real is double, or float to halve the
+  memory and bandwidth for big grids (see DiffusionConfig::floatStorage);
+  either way each update is worked out in double and only rounded when
+  it's stored. This and the other explicit kernels are instantiated for
+  both in diffusioncore.c.
+ function name: stencilStep
+ param1: concs at the current time
+ param2: concs at the next time (boundary layers already set)
+ param3-5: n.o. divisions along x, y and z
+ param6-8: D*dt/h^2 along x, y and z
+ param9: threads to share the z-slabs out over
+ param10: if not 0, gets the 6 link fluxes at the start of the step (see
+          UptakeObservables::linkFlux), read while the slab is in cache
+*/
+template <typename Real>
+void stencilStep(const Real * __restrict__ cur, Real * __restrict__ next,
+ int nx, int ny, int nz, double rx, double ry, double rz, SlabPool &pool,
+ double *linkFlux=0);
+
+/*which parts of the acrylic the explicit stencil has to update. Early in a
+  soak only a thin shell has any water in it and everything deeper is
+  exactly 0, so the acrylic is cut into tiles (tileSizeI() x tileSizeJ()
+  elems of one z-slab, about an eighth of the acrylic along x and y) and
+  only live tiles are updated. A tile goes live once the tile next to it
+  has had an elem over threshold on the side they share, and stays live
+  from then on; the tiles against the water layer are live from the start. A tile
+  that has never been live has never been written, so it is still 0 in
+  both buffers, and the links from a live tile into one are treated as
+  sealed, so no water is lost into elems that are never written. With
+  threshold 0 the answer is exactly what stencilStep gives, but even a
+  trace of water moves an elem a step so the live region soon covers
+  everything. Just above 0 (say 1e-9 of maxConc) it tracks the real front.
+  Water is still conserved, but what's under the threshold at a tile's
+  edge is held back there instead of spreading until that side crosses
+  it, so the concs just ahead of the front are a little off.
+*/
+class ActiveFront {
+ public:
+  enum { kMinTileI = 8, kMaxTileI = 32, kMaxTileJ = 4 };
+  //bits of wet: some elem over threshold, and one on each x and y side.
+  //Tiles are one slab thick, so any elem is on both z sides.
+  enum { kWetAny = 1, kWetXLow = 2, kWetXHigh = 4, kWetYLow = 8, kWetYHigh = 16,
+         kWetAll = 31 };
+
+  ActiveFront(int nx, int ny, int nz, double threshold);
+
+  //n.o. tiles along x, y and z
+  int tilesI() const { return ti; }
+  int tilesJ() const { return tj; }
+  int tilesK() const { return tk; }
+  //elems per tile along x and y
+  int tileSizeI() const { return tileI; }
+  int tileSizeJ() const { return tileJ; }
+  long tile(int a, int b, int c) const { return a + (long)ti*b + (long)ti*tj*c; }
+  bool isLive(long t) const { return live[t]!=0; }
+  //how many elems a step updates now
+  long liveElems() const;
+  //set the flags from a checkpoint, or every tile live and wet if they're 0
+  void restore(const unsigned char *liveFlags, const unsigned char *wetFlags);
+
+  double threshold;
+  std::vector<unsigned char> live; //updated every step
+  std::vector<unsigned char> wet;  //kWet bits of where it's been over threshold
+  std::vector<unsigned char> slabWet; //every tile in the z-slab is kWetAll
+
+ private:
+  int nx, ny, nz;
+  int ti, tj, tk;
+  int tileI, tileJ;
+};
+
+/*stencilStep over only the live tiles of front, then brings front up to
+  date for the next step.
+ function name: stencilStepActive
+ param1: concs at the current time
+ param2: concs at the next time (boundary layers already set)
+ param3-5: n.o. divisions along x, y and z
+ param6-8: D*dt/h^2 along x, y and z
+ param9: the live tiles, updated
+ param10: threads to share the z-slabs out over
+ param11: if not 0, gets the link fluxes as for stencilStep
+*/
+template <typename Real>
+void stencilStepActive(const Real * __restrict__ cur, Real * __restrict__ next,
+ int nx, int ny, int nz, double rx, double ry, double rz, ActiveFront &front,
+ SlabPool &pool, double *linkFlux=0);
+
+//x and y size of the tiles for stencilStepsTiled. Whole rows (up to 512)
+//work best, as the slabs of each column then come in from memory in one
+//contiguous run.
+enum { kTimeTileI = 512, kTimeTileJ = 32 };
+
+/*steps explicit timesteps in one pass over the grid, for grids too big
+  for the cache. The acrylic is cut into kTimeTileI x kTimeTileJ columns
+  running the length of z. Each column goes up z as a wavefront: slab k at
+  step 1, then k-1 at step 2, ... k-steps+1 at the last step. The
+  in-between steps are kept in a ring of 3 slabs per step in a small per
+  thread buffer, so a slab comes in from memory once for all the steps
+  instead of once per step. A column also works out steps-1 elems either
+  side of itself at the first step, one fewer each step after, so columns
+  don't need each other and go on separate threads. Every elem is worked
+  out by cubeElemUpdate from the same numbers as in stencilStep, so the
+  result is bit-identical to calling stencilStep steps times (so long as
+  the compiler doesn't fuse multiply-adds, see the Makefile).
+ function name: stencilStepsTiled
+ param1: concs at the current time
+ param2: concs after the steps (boundary layers already set)
+ param3-5: n.o. divisions along x, y and z
+ param6-8: D*dt/h^2 along x, y and z
+ param9: n.o. timesteps to take
+ param10: threads to share the columns out over
+ param11: if not 0, gets steps*6 link fluxes, what UptakeObservables::linkFlux
+          would give at the start of each step; the steps in between are
+          never all in memory at once so they're added up as we go
+*/
+template <typename Real>
+void stencilStepsTiled(const Real * __restrict__ cur, Real * __restrict__ next,
+ int nx, int ny, int nz, double rx, double ry, double rz, int steps, SlabPool &pool,
+ double *linkFlux=0);
+
+//n.o. scenarios a sweep packs into one grid, see stencilStepLanes
+enum { kSweepLanes = 4 };
+
+/*stencilStep for kSweepLanes scenarios on the same grid at once. The
+  grids are interleaved, conc[elem*kSweepLanes + lane], so the lanes of
+  one elem sit next to each other and the innermost loop (over lanes) is
+  a SIMD vector. Each lane has its own D*dt/h^2, so scenarios can differ
+  in D, dt and the size of the piece, just not in the n.o. divisions.
+  Every lane gets exactly the numbers stencilStep would give it.
+ function name: stencilStepLanes
+ param1: interleaved concs at the current time
+ param2: interleaved concs at the next time (boundary layers already set)
+ param3-5: n.o. divisions along x, y and z
+ param6-8: D*dt/h^2 along x, y and z, kSweepLanes of each
+ param9: threads to share the z-slabs out over
+*/
+void stencilStepLanes(const double * __restrict__ cur, double * __restrict__ next,
+ int nx, int ny, int nz, const double *rx, const double *ry, const double *rz,
+ SlabPool &pool);
+
+/*face diffusivities for variableStencilStep, as D*dt/h^2 for every face
+  between two elems. One array per axis, each the shape of the grid, so the
+  update reads them unit stride right alongside the concs: kx[elem] is the
+  face between elem and elem+1, ky[elem] between elem and elem+nx and
+  kz[elem] between elem and elem+nx*ny.
+*/
+struct FaceCoeffs {
+ FaceCoeffs(long cells) : kx(cells, 0.0), ky(cells, 0.0), kz(cells, 0.0) {}
+ std::vector<double> kx, ky, kz;
+};
+
+/*fills the face diffusivities from one D per elem, each face getting the
+  mean of the two elems either side of it. Only the faces the acrylic's
+  updates use (the acrylic and the links to the water layer) are set.
+ function name: setFaceCoeffs
+ param1: D of every elem, or 0 for dScale everywhere
+ param2: multiplies every D, e.g. for the temperature
+ param3-5: n.o. divisions along x, y and z
+ param6-8: dt/h^2 along x, y and z
+ param9: the face diffusivities (output)
+ param10: threads to share the z-slabs out over
+*/
+void setFaceCoeffs(const double *cellD, double dScale, int nx, int ny, int nz,
+ double sx, double sy, double sz, FaceCoeffs &faces, SlabPool &pool);
+
+/*one explicit timestep with D varying from face to face: theElem gains
+  kFace*(neighbour - theElem) over each of its 6 faces. With the same D on
+  every face it's cubeElemUpdate. Stable as long as the 6 face values
+  round every elem add up to no more than 1.
+ function name: variableStencilStep
+ param1: concs at the current time
+ param2: concs at the next time (boundary layers already set)
+ param3-5: n.o. divisions along x, y and z
+ param6: face diffusivities, see FaceCoeffs
+ param7: threads to share the z-slabs out over
+ param8: if not 0, gets the link fluxes into the acrylic through each face
+         (EFace order) from the water layer, as stencilStep
+*/
+void variableStencilStep(const double * __restrict__ cur, double * __restrict__ next,
+ int nx, int ny, int nz, const FaceCoeffs &faces, SlabPool &pool, double *linkFlux=0);
+
+//temperature against time for kVariableStencil, read by
+//readTemperatureSchedule. In between the points it's a straight line, and
+//before the first one and after the last it stays where it was.
+struct TemperatureSchedule {
+ std::vector<double> time; //seconds, going up
+ std::vector<double> kelvin;
+ double at(double t) const;
+ double hottest() const;
+};
+
+/*reads a temperature schedule, one "time,temperature" line per point with
+  the time in seconds and the temperature in kelvin. Blank lines, lines
+  starting with # and a header line are skipped.
+ function name: readTemperatureSchedule
+ param1: file to read
+ param2: the schedule (output)
+ output: 0, or 1 if the file can't be read or the times don't go up
+*/
+int readTemperatureSchedule(const char *fileName, TemperatureSchedule &schedule);
+
+//Arrhenius factor that turns D at refKelvin into D at kelvin, for an
+//activation energy in J/mol
+inline double arrheniusFactor(double activationEnergy, double refKelvin, double kelvin)
+{
+ const double gasConstant = 8.314462618; //J/(mol K)
+ return exp(-activationEnergy/gasConstant*(1/kelvin - 1/refKelvin));
+}
+
+/*factorizes the tridiagonal matrix (1+2*theta*r) on the diagonal and
+  -theta*r off it, for a line of n unknowns with fixed (Dirichlet) ends.
+  A sealed (zero flux) end has its ghost elem equal to the end unknown, so
+  that row's diagonal is 1+theta*r instead.
+  Every line along an axis has the same matrix so this is done once per
+  axis per step and the Thomas solve just reuses cp and m.
+ function name: thomasFactor
+ param1: theta*D*dt/h^2 for the axis
+ param2: n.o. unknowns in the line
+ param3: modified upper coefficients, n long (output)
+ param4: reciprocal pivots, n long (output)
+ param5: true if the low end is sealed
+ param6: true if the high end is sealed
+*/
+void thomasFactor(double thetaR, int n, double *cp, double *m,
+ bool lowSealed=false, bool highSealed=false);
+
+/*one Douglas-Gunn ADI timestep (Crank-Nicolson when theta=0.5). Solves
+    (1-theta*Lx)(1-theta*Ly)(1-theta*Lz) delta = (Lx+Ly+Lz) conc
+  as three tridiagonal sweeps, one per axis, then conc += delta. Lx etc. are
+  the D*dt*second difference/h^2 operators. delta is 0 on the two fixed
+  layers, so only the acrylic core (n-4 unknowns per line) is solved for.
+  Stable for any dt; theta=1 is backward Euler which we use for the first
+  couple of steps to damp the ringing from the jump at the water layer.
+  Lines in x and y are shared out by z-slab, lines in z by y-slab.
+  Faces in sealedFaces (bit 1<<EFace) are zero flux: their water layer
+  elems must hold a copy of the acrylic next to them (see refreshGhosts).
+ function name: adiStep
+ param1: concs, updated in place
+ param2: scratch grid of nx*ny*nz for delta
+ param3-5: n.o. divisions along x, y and z
+ param6-8: D*dt/h^2 along x, y and z
+ param9: theta, 0.5 for Crank-Nicolson
+ param10: scratch of at least 2*(nx+ny+nz) doubles
+ param11: threads to share the slabs out over
+ param12: bit mask of sealed faces, 0 for all fixed
+ param13: if not 0, gets the change in the acrylic's conc added up over
+          every elem, i.e. what came in through the faces this step
+ output: the biggest |change| in any elem this step
+*/
+double adiStep(double * __restrict__ conc, double * __restrict__ delta,
+ int nx, int ny, int nz, double rx, double ry, double rz, double theta,
+ double *work, SlabPool &pool, int sealedFaces=0, double *totalChange=0);
+
+/*Fourier series solutions of Fick's law for a box, from zero, with its
+  whole surface held at a fixed conc (Crank, "The Mathematics of
+  Diffusion", ch. 2 and 6). Along each axis the box is 0 to L and tau =
+  D*t/L^2; the 3D answer is the product of one series per axis. Terms are
+  added until they're under 1e-17, which takes more of them for small tau
+  (~1/sqrt(tau)), but is still only milliseconds.
+ function name: boxUptakeFraction
+ param1-3: tau along x, y and z
+ output: M(t)/M(infinity) = 1 - product over the axes of
+         sum over odd m of 8/(m pi)^2 exp(-(m pi)^2 tau)
+*/
+double boxUptakeFraction(double tauX, double tauY, double tauZ);
+
+/*conc at a point in the box, as for boxUptakeFraction.
+ function name: boxConcFraction
+ param1-3: position as a fraction of the box along x, y and z
+ param4-6: tau along x, y and z
+ output: conc/surface conc = 1 - product over the axes of
+         sum over odd m of 4/(m pi) sin(m pi f) exp(-(m pi)^2 tau)
+*/
+double boxConcFraction(double fx, double fy, double fz, double tauX, double tauY,
+ double tauZ);
+
+/*conc in a slab 0 to L with x=0 held at a fixed conc and x=L sealed, from
+  zero, i.e. half of a slab 2L thick wet on both sides. What kBreakthrough
+  does with the other faces sealed.
+ function name: slabConcFraction
+ param1: x/L
+ param2: D*t/L^2
+ output: conc/source conc
+*/
+double slabConcFraction(double fx, double tau);
+
+/*D*t/L^2 when slabConcFraction(fx, tau) gets to frac, by bisection.
+ function name: slabBreakthroughTau
+ param1: x/L, 1 for the sealed face
+ param2: fraction of the source conc, 0 to 1
+ output: tau, or -1 if frac isn't between 0 and 1
+*/
+double slabBreakthroughTau(double fx, double frac);
+
+/*the moves a molecule group can make: stay put plus the 6 face
+  neighbours (N=7), plus the 12 edge neighbours (N=19), or all 26
+  neighbours (N=27). Built at compile time. For N=27 move r is the
+  numbering of the random walk (0 to 26, front slice to back slice, bottom
+  row to top, left to right, 13 = stay put); N=19 is the same order with
+  the corners left out; N=7 is stay put then -x,+x,-y,+y,-z,+z.
+*/
+template <int N>
+struct Neighbourhood {
+ static_assert(N==7 || N==19 || N==27, "a neighbourhood is 7, 19 or 27 moves");
+ int dx[N], dy[N], dz[N];
+
+ constexpr Neighbourhood() : dx(), dy(), dz() {
+  int d = 0;
+  if (N==7) {
+   const int faceDx[7] = {0, -1, 1, 0, 0, 0, 0};
+   const int faceDy[7] = {0, 0, 0, -1, 1, 0, 0};
+   const int faceDz[7] = {0, 0, 0, 0, 0, -1, 1};
+   for (; d<7; d++) {
+    dx[d] = faceDx[d]; dy[d] = faceDy[d]; dz[d] = faceDz[d];
+   }
+   return;
+  }
+  for (int dk=-1; dk<=1; dk++) {
+   for (int dj=-1; dj<=1; dj++) {
+    for (int di=-1; di<=1; di++) {
+     const int away = (di!=0) + (dj!=0) + (dk!=0);
+     if (N==19 && away==3) continue;
+     dx[d] = di; dy[d] = dj; dz[d] = dk;
+     d++;
+    }
+   }
+  }
+ }
+};
+
+/*where a molecule group ends up after move r: just elem plus a table
+  offset, no branches. The moves come from Neighbourhood<N> at compile
+  time and are turned into offsets once for the grid. Only good for elems
+  off the outer face, where every move stays on the grid; the outer face
+  never walks.
+*/
+template <int N>
+class NeighbourMoves {
+ public:
+  NeighbourMoves(int nx, int ny) {
+   for (int d=0; d<N; d++) {
+    off[d] = kHood.dx[d] + (long)nx*kHood.dy[d] + (long)nx*ny*kHood.dz[d];
+   }
+  }
+
+  static constexpr int moves() { return N; }
+
+  long offset(int r) const { return off[r]; }
+
+  long move(long elem, int r) const { return elem + off[r]; }
+
+ private:
+  static constexpr Neighbourhood<N> kHood = Neighbourhood<N>();
+  long off[N];
+};
+
+/*one step of the random walk done in bulk: instead of one random number
+  per molecule group, each element draws a single multinomial split of all
+  its groups over the nDest destinations (as a chain of binomials, each
+  move equally likely). Cost is per element, not per molecule, so
+  fakeAvoNum can go up without the run getting slower. Reads grpCur and
+  adds into grpNext, so visiting order doesn't matter. The 1st layer
+  doesn't walk, same as the per-molecule version.
+  A z-slab only adds into itself and the slabs either side, so slabs are
+  done on the threads in 3 passes (k%3==0, 1, 2) and two threads never
+  touch the same element. Counts are whole numbers and the draws only
+  depend on the PRNG counter, so any n.o. threads gives the same answer.
+ function name: multinomialStep
+ param1: molecule groups per element now
+ param2: molecule groups per element after the step (output)
+ param3-5: n.o. divisions along x, y and z
+ param6: the moves, a NeighbourMoves
+ param7: seed for the counter based PRNG
+ param8: which timestep this is, for the PRNG counter
+ param9: threads to share the z-slabs out over
+*/
+template <class Moves>
+void multinomialStep(const long long *grpCur, long long *grpNext, int nx, int ny,
+ int nz, const Moves &moves, unsigned long long seed, unsigned int step,
+ SlabPool &pool)
+{
+ const int nDest = Moves::moves();
+ const long sy = nx;
+ const long sz = (long)nx*ny;
+ pool.run(nz, [=](int k) { std::fill(grpNext+k*sz, grpNext+(k+1)*sz, 0LL); });
+ for (int colour=0; colour<3; colour++) {
+  const int nSlabs = (nz-colour)/3; //slabs k=1+colour, 4+colour, .. <= nz-2
+  pool.run(nSlabs, [=](int slab) {
+   const int k = 1 + colour + 3*slab;
+   //only elems off the outer face walk, so every one is interior and
+   //takes the unchecked move
+   for (int j=1; j<ny-1; j++) {
+    for (int i=1; i<nx-1; i++) {
+     const long elem = i + j*sy + k*sz;
+     long long left = grpCur[elem];
+     if (left==0) continue;
+     CounterRng rng(seed, step, (unsigned int)elem, 0, 1);
+     for (int d=0; d<nDest-1 && left>0; d++) {
+      long long moved = counterBinomial(rng, left, 1.0/(nDest-d));
+      grpNext[moves.move(elem, d)] += moved;
+      left -= moved;
+     }
+     grpNext[moves.move(elem, nDest-1)] += left;
+    }
+   }
+  });
+ }
+}
+
+//one row of the UptakeObservables time series
+struct UptakeSample {
+ long long step;
+ double time;
+ double absorbed; //moles taken up by the acrylic since the start
+ double faceFlux[6]; //moles in through each face (EFace order) this step
+};
+
+/*how much water the acrylic has taken up, kept up to date from the flow
+  across the links between the water layer and the acrylic rather than by
+  adding up the whole grid. Inside the acrylic every link takes from one
+  elem what it gives to the next, so the only way the total can change is
+  through those boundary links: r*(water - acrylic) per link per step for
+  the explicit stencil. Reading them is O(surface), so it's cheap enough
+  to do every step. ADI's theta-weighted link fluxes don't add up to what
+  the split step moves, so adiStep adds up its change over the acrylic as
+  it goes and the faces share that out in proportion to their link flux.
+  conservationError() does add up the whole grid, to check the running
+  total at the end of a run; for the explicit stencil it's round off. For
+  ADI and breakthrough the total is the grid's change by construction, so
+  it's only round off there too and doesn't say anything about the
+  scheme's splitting error; the split between the faces is the part
+  that's approximate.
+*/
+class UptakeObservables {
+ public:
+  UptakeObservables(int nx, int ny, int nz, double elemVol, const double *conc,
+                    int sealedFaces=0);
+
+  //sum over the links of each face of r*(water - acrylic) for these concs,
+  //in conc units. Sealed faces are always 0.
+  void linkFlux(const double *conc, double rx, double ry, double rz, double flux[6]) const;
+  //add a step's link fluxes (as from linkFlux) to the running totals and
+  //the time series
+  void addStep(long long step, double time, const double flux[6]);
+
+  double acrylicMoles() const { return initialMoles + absorbed; }
+  //(moles in the acrylic, added up) - acrylicMoles(), as a fraction of
+  //what's been taken up; conc is double or float
+  template <typename Real>
+  double conservationError(const Real *conc) const;
+  //write the time series as csv, false if the file can't be opened
+  bool write(const char *fileName) const;
+
+  double elemVol;
+  double initialMoles; //in the acrylic at the start
+  double absorbed;
+  double faceTotal[6]; //moles in through each face since the start
+  std::vector<UptakeSample> series;
+
+ private:
+  template <typename Real>
+  double addUpAcrylic(const Real *conc) const;
+
+  int nx, ny, nz;
+  int sealedFaces;
+};
+
+//layout of the snapshot file written by SnapshotHistory: this header,
+//then one chunk per snapshot, each chunk the step, the time and then
+//nx*ny*nz doubles of conc. Chunks are all the same size so snapshot q is
+//at sizeof(header) + q*chunkBytes.
+struct SnapshotFileHeader {
+ char magic[8];  //"DIFSNAP1"
+ int nx, ny, nz;
+ int version;
+ long long cells;
+ long long chunkBytes;
+};
+
+/*hands snapshots from a run to something that draws them on another
+  thread, e.g. the ROOT macro's plotter. The run side never waits: a
+  snapshot goes into one of depth frames allocated up front, and if they're
+  all still queued or being drawn it's dropped (and counted) instead. The
+  drawing side takes the oldest queued frame with next(), draws it and
+  gives it back with release(). The run side calls close() when it's done.
+*/
+struct SnapshotFrame {
+ SnapshotFrame(long cells) : step(0), time(0), conc(cells) {}
+ long long step;
+ double time;
+ std::vector<double> conc;
+};
+
+class SnapshotQueue {
+ public:
+  SnapshotQueue(long cells, int depth=4) : nDropped(0), isClosed(false) {
+   for (int q=0; q<depth; q++) frames.push_back(SnapshotFrame(cells));
+   for (int q=0; q<depth; q++) freeFrames.push_back(&frames[q]);
+  }
+
+  //copies conc into a free frame and queues it, or returns false straight
+  //away if there isn't one
+  bool tryPush(long long step, double time, const double *conc) {
+   SnapshotFrame *frame;
+   {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (freeFrames.empty()) {
+     nDropped++;
+     return false;
+    }
+    frame = freeFrames.back();
+    freeFrames.pop_back();
+   }
+   frame->step = step;
+   frame->time = time;
+   memcpy(&frame->conc[0], conc, frame->conc.size()*sizeof(double));
+   {
+    std::lock_guard<std::mutex> lock(mtx);
+    queued.push_back(frame);
+   }
+   ready.notify_one();
+   return true;
+  }
+
+  void close() {
+   {
+    std::lock_guard<std::mutex> lock(mtx);
+    isClosed = true;
+   }
+   ready.notify_all();
+  }
+
+  //the oldest queued frame, waiting up to waitMs for one; 0 if there's
+  //none by then. Give it back with release() once drawn.
+  const SnapshotFrame *next(int waitMs) {
+   std::unique_lock<std::mutex> lock(mtx);
+   ready.wait_for(lock, std::chrono::milliseconds(waitMs),
+                  [this]{ return isClosed || !queued.empty(); });
+   if (queued.empty()) return 0;
+   SnapshotFrame *frame = queued.front();
+   queued.pop_front();
+   return frame;
+  }
+
+  void release(const SnapshotFrame *frame) {
+   std::lock_guard<std::mutex> lock(mtx);
+   freeFrames.push_back(const_cast<SnapshotFrame*>(frame));
+  }
+
+  //closed and everything queued has been taken
+  bool finished() {
+   std::lock_guard<std::mutex> lock(mtx);
+   return isClosed && queued.empty();
+  }
+
+  long long dropped() {
+   std::lock_guard<std::mutex> lock(mtx);
+   return nDropped;
+  }
+
+ private:
+  std::deque<SnapshotFrame> frames; //deque so the frames never move
+  std::vector<SnapshotFrame*> freeFrames;
+  std::deque<SnapshotFrame*> queued;
+  long long nDropped;
+  bool isClosed;
+  std::mutex mtx;
+  std::condition_variable ready;
+};
+
+/*keeps the conc history without holding every elem at every timestep.
+  The last ringSteps steps stay in memory in a ring buffer, and every
+  snapshotEvery steps a full snapshot is handed to a writer thread that
+  streams it to the snapshot file, so the solver carries on while the disk
+  catches up. Memory is O(nx*ny*nz) however long the run is. If the writer
+  falls more than a few snapshots behind, record() waits for it rather than
+  using more memory. Every plotEvery steps the concs are also offered to a
+  SnapshotQueue, if there is one, for drawing while the run goes on.
+*/
+class SnapshotHistory {
+ public:
+  SnapshotHistory(long cells, int nx, int ny, int nz, int ringSteps,
+                  int snapshotEvery, const char *fileName)
+   : cells(cells), ringSteps(ringSteps), snapshotEvery(snapshotEvery),
+     ring((long)ringSteps*cells), ringStep(ringSteps, -1LL), file(0), plotQueue(0),
+     plotEvery(0), stopping(false) {
+   if (snapshotEvery<=0 || fileName==0) return;
+   file = fopen(fileName, "wb");
+   if (!file) {
+    std::cout << "can't open snapshot file " << fileName << ", not saving snapshots" << std::endl;
+    return;
+   }
+   SnapshotFileHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, "DIFSNAP1", 8);
+   header.nx = nx; header.ny = ny; header.nz = nz;
+   header.version = 1;
+   header.cells = cells;
+   header.chunkBytes = sizeof(long long) + sizeof(double) + cells*sizeof(double);
+   fwrite(&header, sizeof(header), 1, file);
+   for (int q=0; q<kQueueDepth; q++) freeChunks.push_back(new Chunk(cells));
+   writer = std::thread(&SnapshotHistory::writerLoop, this);
+  }
+
+  ~SnapshotHistory() {
+   if (file) {
+    {
+     std::lock_guard<std::mutex> lock(mtx);
+     stopping = true;
+    }
+    queued.notify_one();
+    writer.join();
+    fclose(file);
+    for (size_t q=0; q<freeChunks.size(); q++) delete freeChunks[q];
+   }
+  }
+
+  void publishTo(SnapshotQueue *queue, int every) {
+   plotQueue = queue;
+   plotEvery = every;
+  }
+
+  //call once per step with the concs at the end of it
+  void record(long long step, double time, const double *conc) {
+   if (plotQueue && step%plotEvery==0) plotQueue->tryPush(step, time, conc);
+   if (ringSteps>0) {
+    const int slot = (int)(step%ringSteps);
+    memcpy(&ring[slot*cells], conc, cells*sizeof(double));
+    ringStep[slot] = step;
+   }
+   if (!file || step%snapshotEvery!=0) return;
+   Chunk *chunk;
+   {
+    std::unique_lock<std::mutex> lock(mtx);
+    freed.wait(lock, [this]{ return !freeChunks.empty(); });
+    chunk = freeChunks.back();
+    freeChunks.pop_back();
+   }
+   chunk->step = step;
+   chunk->time = time;
+   memcpy(&chunk->conc[0], conc, cells*sizeof(double));
+   {
+    std::lock_guard<std::mutex> lock(mtx);
+    toWrite.push_back(chunk);
+   }
+   queued.notify_one();
+  }
+
+  //concs from stepsAgo steps before the latest one recorded (0 = latest),
+  //or 0 if that step isn't in the ring any more
+  const double *recent(long long latestStep, int stepsAgo) const {
+   if (stepsAgo<0 || stepsAgo>=ringSteps) return 0;
+   const long long step = latestStep - stepsAgo;
+   if (step<0) return 0;
+   const int slot = (int)(step%ringSteps);
+   return ringStep[slot]==step ? &ring[slot*cells] : 0;
+  }
+
+ private:
+  enum { kQueueDepth = 4 };
+  struct Chunk {
+   Chunk(long cells) : step(0), time(0), conc(cells) {}
+   long long step;
+   double time;
+   std::vector<double> conc;
+  };
+
+  void writerLoop() {
+   for (;;) {
+    Chunk *chunk;
+    {
+     std::unique_lock<std::mutex> lock(mtx);
+     queued.wait(lock, [this]{ return stopping || !toWrite.empty(); });
+     if (toWrite.empty()) return; //stopping and nothing left
+     chunk = toWrite.front();
+     toWrite.pop_front();
+    }
+    fwrite(&chunk->step, sizeof(long long), 1, file);
+    fwrite(&chunk->time, sizeof(double), 1, file);
+    fwrite(&chunk->conc[0], sizeof(double), cells, file);
+    {
+     std::lock_guard<std::mutex> lock(mtx);
+     freeChunks.push_back(chunk);
+    }
+    freed.notify_one();
+   }
+  }
+
+  long cells;
+  int ringSteps, snapshotEvery;
+  std::vector<double> ring;
+  std::vector<long long> ringStep;
+  FILE *file;
+  SnapshotQueue *plotQueue;
+  int plotEvery;
+  std::thread writer;
+  std::mutex mtx;
+  std::condition_variable queued, freed;
+  std::deque<Chunk*> toWrite;
+  std::vector<Chunk*> freeChunks;
+  bool stopping;
+};
+
+/*reads a snapshot file back for post-processing. The file is mmap'd, so
+  opening it is instant whatever its size and only the snapshots that are
+  looked at get read off the disk. A chunk cut short (e.g. the run was
+  killed mid-write) is left out.
+*/
+class SnapshotReader {
+ public:
+  SnapshotReader(const char *fileName) : base(0), mapBytes(0), nSnapshots(0) {
+   memset(&header, 0, sizeof(header));
+   int fd = open(fileName, O_RDONLY);
+   if (fd<0) return;
+   struct stat st;
+   if (fstat(fd, &st)==0 && st.st_size>=(off_t)sizeof(SnapshotFileHeader)) {
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map!=MAP_FAILED) {
+     base = (const char*)map;
+     mapBytes = st.st_size;
+     memcpy(&header, base, sizeof(header));
+     if (memcmp(header.magic, "DIFSNAP1", 8)!=0 || header.chunkBytes<=0) {
+      munmap(map, mapBytes);
+      base = 0;
+     }
+     else nSnapshots = (int)((mapBytes - sizeof(header))/header.chunkBytes);
+    }
+   }
+   close(fd);
+  }
+
+  ~SnapshotReader() { if (base) munmap((void*)base, mapBytes); }
+
+  bool isOpen() const { return base!=0; }
+  int snapshots() const { return nSnapshots; }
+  long cells() const { return (long)header.cells; }
+  int nx() const { return header.nx; }
+  int ny() const { return header.ny; }
+  int nz() const { return header.nz; }
+
+  long long step(int q) const {
+   long long value;
+   memcpy(&value, chunk(q), sizeof(value));
+   return value;
+  }
+  double time(int q) const {
+   double value;
+   memcpy(&value, chunk(q)+sizeof(long long), sizeof(value));
+   return value;
+  }
+  const double *conc(int q) const {
+   return (const double*)(chunk(q) + sizeof(long long) + sizeof(double));
+  }
+
+ private:
+  const char *chunk(int q) const { return base + sizeof(header) + (long)q*header.chunkBytes; }
+
+  const char *base;
+  size_t mapBytes;
+  int nSnapshots;
+  SnapshotFileHeader header;
+};
+
+//what's in a checkpoint besides the concs. The file is this header, then
+//nx*ny*nz doubles of conc, then frontTiles bytes each of the ActiveFront's
+//live and wet flags. The uptake time series goes in its own file (see
+//checkpointSeriesFile) that's only added to as the run goes, so a
+//checkpoint doesn't get bigger with every step done; the first
+//seriesLength samples in it are this checkpoint's.
+struct CheckpointHeader {
+ char magic[8]; //"DIFCHKP1"
+ int version;
+ int solverMode;
+ int nx, ny, nz;
+ int walkNeighbours;
+ long long step; //steps done
+ double time; //seconds done (steps for the walks)
+ //the run that saved it: the dt it used and the one its config asked for
+ //(0 for the solver's own), and the D, maxConc and holderConc it ran with,
+ //drying included. A resumed run has to match all of these.
+ double timestep, timestepAsked;
+ double xTotLen, yTotLen, zTotLen, dCoeff, maxConc, holderConc, fakeAvoNum;
+ unsigned long long walkSeed; //the walks' random numbers only depend on the
+                              //seed, step and elem, so this and step are
+                              //all the random state there is
+ //UptakeObservables' totals
+ double initialMoles, absorbed, faceTotal[6];
+ long long seriesLength; //samples of the time series up to step
+ long long frontTiles; //0 if the run has no ActiveFront
+};
+
+//a whole checkpoint in memory. series is the samples from seriesFrom up
+//to header.seriesLength; readCheckpoint gets them all.
+struct Checkpoint {
+ CheckpointHeader header;
+ std::vector<double> conc;
+ std::vector<unsigned char> live, wet;
+ long long seriesFrom;
+ std::vector<UptakeSample> series;
+};
+
+//the file a checkpoint's uptake time series goes in: fileName.series
+std::string checkpointSeriesFile(const char *fileName);
+
+/*adds checkpoint's samples to the series file, after the first seriesFrom
+  already there, then writes the rest to fileName.tmp and renames it to
+  fileName, so the old checkpoint is only replaced by a complete new one.
+  Anything in the series file past the old checkpoint's seriesLength
+  isn't part of it, so it's still whole if this fails half way.
+ function name: writeCheckpoint
+ param1: file to write
+ param2: what to write
+ output: false if it couldn't be written; the old checkpoint is still there
+*/
+bool writeCheckpoint(const char *fileName, const Checkpoint &checkpoint);
+
+/*reads a checkpoint written by writeCheckpoint, series and all.
+ function name: readCheckpoint
+ param1: file to read
+ param2: filled in from the file
+ output: false if it can't be read or isn't a checkpoint
+*/
+bool readCheckpoint(const char *fileName, Checkpoint &checkpoint);
+
+/*saves a checkpoint every few steps without holding up the solver. save()
+  copies the state into a spare Checkpoint and a writer thread writes that
+  out with writeCheckpoint while the run carries on. There's only the one
+  spare, so if the writer is still on the last checkpoint save() waits for
+  it. Only the uptake samples since the last checkpoint written are copied
+  and written, so a save costs the grid and not the whole run so far.
+  seriesOnDisk is how many are in the series file already (a run resumed
+  from the same file); otherwise the first save writes the series from the
+  start.
+*/
+class CheckpointWriter {
+ public:
+  CheckpointWriter(int checkpointEvery, const char *fileName, long long seriesOnDisk=0)
+   : checkpointEvery(fileName ? checkpointEvery : 0), fileName(fileName ? fileName : ""),
+     seriesOnDisk(seriesOnDisk), pending(false), stopping(false) {
+   if (this->checkpointEvery>0) writer = std::thread(&CheckpointWriter::writerLoop, this);
+  }
+
+  ~CheckpointWriter() {
+   if (checkpointEvery<=0) return;
+   {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+   }
+   queued.notify_one();
+   writer.join();
+  }
+
+  //is there a checkpoint at the end of this step?
+  bool due(long long step) const { return checkpointEvery>0 && step%checkpointEvery==0; }
+
+  //header has everything but the observables and front filled in; front
+  //and uptake can be 0
+  void save(const CheckpointHeader &header, const double *conc, long cells,
+            const ActiveFront *front, const UptakeObservables *uptake) {
+   {
+    std::unique_lock<std::mutex> lock(mtx);
+    written.wait(lock, [this]{ return !pending; });
+   }
+   spare.header = header;
+   spare.conc.assign(conc, conc+cells);
+   if (front) {
+    spare.live = front->live;
+    spare.wet = front->wet;
+   }
+   else {
+    spare.live.clear();
+    spare.wet.clear();
+   }
+   spare.header.frontTiles = spare.live.size();
+   //the writer's done, so seriesOnDisk is up to date
+   spare.seriesFrom = 0;
+   spare.series.clear();
+   if (uptake) {
+    spare.header.initialMoles = uptake->initialMoles;
+    spare.header.absorbed = uptake->absorbed;
+    for (int face=0; face<6; face++) spare.header.faceTotal[face] = uptake->faceTotal[face];
+    spare.seriesFrom = std::min(seriesOnDisk, (long long)uptake->series.size());
+    spare.series.assign(uptake->series.begin() + spare.seriesFrom, uptake->series.end());
+   }
+   spare.header.seriesLength = spare.seriesFrom + spare.series.size();
+   {
+    std::lock_guard<std::mutex> lock(mtx);
+    pending = true;
+   }
+   queued.notify_one();
+  }
+
+ private:
+  void writerLoop() {
+   for (;;) {
+    {
+     std::unique_lock<std::mutex> lock(mtx);
+     queued.wait(lock, [this]{ return stopping || pending; });
+     if (!pending) return; //stopping and nothing left
+    }
+    const bool ok = writeCheckpoint(fileName.c_str(), spare);
+    if (!ok) std::cout << "can't write checkpoint " << fileName << std::endl;
+    {
+     std::lock_guard<std::mutex> lock(mtx);
+     //if it failed the next one writes these samples again
+     if (ok) seriesOnDisk = spare.header.seriesLength;
+     pending = false;
+    }
+    written.notify_one();
+   }
+  }
+
+  int checkpointEvery;
+  std::string fileName;
+  long long seriesOnDisk;
+  Checkpoint spare;
+  std::thread writer;
+  std::mutex mtx;
+  std::condition_variable queued, written;
+  bool pending, stopping;
+};
+
+/*everything a run needs. The constructor gives Tom's 3rd dogbone soaking
+  at room temperature, on a 5x5x5 grid with the original molecule walk;
+  change whatever is needed before calling runDiffusion.
+*/
+struct DiffusionConfig {
+ DiffusionConfig();
+
+ int solverMode; //see ESolverMode
+ int nx, ny, nz; //n.o. divisions along x, y and z, at least 5 each
+ int totTime; //n.o. timesteps, for all but kBreakthrough
+ double timestep; //seconds per step for the grid solvers. 0 means 90% of
+                  //the stability limit for kExplicitStencil, one hour for
+                  //kImplicitADI and 60 s to start kBreakthrough from
+ int walkNeighbours; //moves for both random walks: 27, 19 or 7
+ unsigned long long walkSeed; //seed for both random walks
+ int nThreads; //threads for the grid solvers and kMultinomialWalk, 0 means
+               //one per core
+ double fakeAvoNum; //n.o. leader molecules (groups) per mole for the walks
+ int tileSteps; //kExplicitStencil takes this many steps per pass over the grid
+               //(see stencilStepsTiled), 1 for one at a time, 0 to pick 4
+               //for grids too big for the cache and 1 otherwise, or with
+               //frontThreshold. Steps in between printouts and snapshots
+               //don't go into the history.
+ double frontThreshold; //over 0, kExplicitStencil only updates tiles with
+                        //water over this fraction of maxConc (see
+                        //ActiveFront); 0 updates the whole grid every step.
+                        //The front goes one step at a time, so it can't go
+                        //with tileSteps over 1
+
+ //size of the acrylic piece in metres
+ double xTotLen, yTotLen, zTotLen;
+ double dCoeff; //diffusion constant of water in acrylic, m^2/s
+ double maxConc; //conc of the water layer in moles/unit volume, 0 for
+                 //2% of the acrylic's mass in water over the whole piece
+ double holderConc; //conc of the outer (1st) layer
+
+ //kBreakthrough: water goes on sourceFace (see EFace), and we stop when
+ //the mean (or max) conc in the acrylic next to the opposite face gets to
+ //breakthroughFrac*maxConc
+ int sourceFace;
+ double breakthroughFrac;
+ bool breakthroughUseMax;
+ bool breakthroughSealed; //other faces zero flux, else dry (conc 0)
+ double breakthroughMaxTime; //give up after this many seconds
+ bool adaptiveTimestep; //grow dt while little is changing
+
+ int historySteps; //how many of the latest steps to keep in memory, 0 for
+                  //none. Costs a copy of the grid every step
+ int snapshotEvery; //save a full snapshot to snapshotFile every this many
+                    //steps, 0 for never
+ const char *snapshotFile; //read with SnapshotReader
+ const char *observablesFile; //the grid solvers write the uptake time series
+                              //here (see UptakeObservables), 0 for don't
+
+ int checkpointEvery; //save the whole state of the run to checkpointFile
+                      //every this many steps, 0 for never. Not kBreakthrough
+ const char *checkpointFile;
+ const char *resumeFile; //carry on the run saved in this checkpoint up to
+                         //totTime steps, 0 to start from the beginning.
+                         //Its dt, lengths, D and concs have to be this
+                         //config's; startFrom is for changing them
+ const char *startFrom; //start a new phase (e.g. drying after a soak) from
+                        //the concs in this checkpoint, with this config
+ bool drying; //the acrylic is out in dry air: both outer layers at conc 0
+              //and D is dCoeffAir
+ double dCoeffAir; //D of saturated acrylic in dry air, 0 for dCoeff
+
+ bool floatStorage; //kExplicitStencil keeps the grid in floats (half the
+                    //memory and bandwidth), each update still worked out
+                    //in double. Only printed and saved steps go into the
+                    //history
+ bool compareDouble; //with floatStorage, run the double grid as well and
+                     //print how far the float one is off
+
+ SnapshotQueue *plotQueue; //offer the concs to this queue every plotEvery
+                           //steps (0 for totTime/50) for drawing on another
+                           //thread, 0 for don't. Not kAnalytic
+ int plotEvery;
+
+ bool analyticGridLengths; //kAnalytic: the box is the acrylic as the grid
+                           //solvers see it, (n-3) elems between the water
+                           //layers, not the whole piece, and the uptake is
+                           //over the (n-4) acrylic elems
+ int validateSolver; //kAnalytic: run this ESolverMode (not kBreakthrough)
+                     //instead and compare it with the series, -1 for don't
+
+ //kVariableStencil: D = dCoeff*arrheniusFactor(activationEnergy,
+ //refTemperature, T)*exp(concCoeff*conc/saturated conc), with T from the
+ //schedule in temperatureFile (see readTemperatureSchedule), or
+ //refTemperature all through if that's 0
+ const char *temperatureFile;
+ double activationEnergy; //J/mol, 0 for D not changing with temperature
+ double refTemperature; //kelvin, the temperature dCoeff is for
+ double concCoeff; //0 for D not changing with conc
+};
+
+//conc of the water layer for config: maxConc, or if that's 0, 2% of the
+//acrylic's mass in water (0.0262599 moles for Tom's dogbone) spread over
+//the piece
+double waterLayerConc(const DiffusionConfig &config);
+
+/*seconds per step for the grid solvers, see DiffusionConfig::timestep.
+ function name: gridTimestep
+ param1: the set up, for solverMode and timestep
+ param2: D in m^2/s
+ param3-5: x, y and z size of an elem in metres
+ param6: say so if config.timestep is cut down to the stability limit
+ output: dt in seconds
+*/
+double gridTimestep(const DiffusionConfig &config, double D, double xLen, double yLen,
+ double zLen, bool warn=true);
+
+/*runs the model as set up in config, printing the progress to stdout.
+ function name: runDiffusion
+ param1: the set up
+ param2: if not 0, gets the concs in every elem at the end of the run
+ output: 0 if it ran, 1 if the set up doesn't make sense
+*/
+int runDiffusion(const DiffusionConfig &config, std::vector<double> *finalConc=0);
+
+//one scenario of a sweep: a name for the results and its settings
+struct SweepScenario {
+ std::string name;
+ DiffusionConfig config;
+};
+
+/*reads a table of scenarios for runSweep. Comma separated, the first line
+  names the columns, any of
+    name, mode, divs, nx, ny, nz, xlen, ylen, zlen, D, holderConc,
+    maxConc, steps, dt
+  in any order; anything not given is the DiffusionConfig default. mode is
+  stencil or adi.
+ function name: readSweepScenarios
+ param1: the table
+ param2: the scenarios (output)
+ output: 0 if it read, 1 if not
+*/
+int readSweepScenarios(const char *fileName, std::vector<SweepScenario> &scenarios);
+
+/*runs every scenario and writes how much water the acrylic has taken up
+  over time to one results file, a line per scenario per output step:
+    scenario,step,time,waterMoles,centreConc
+  Stencil scenarios on the same grid with the same n.o. steps go through
+  together, kSweepLanes at a time (see stencilStepLanes); the batches, and
+  the ADI scenarios, are shared out over the threads.
+ function name: runSweep
+ param1: the scenarios
+ param2: file to write the results to
+ param3: n.o. threads, 0 for one per core
+ param4: write every this many steps, 0 for 50 lines per scenario
+ output: 0 if it ran, 1 if a scenario doesn't make sense
+*/
+int runSweep(const std::vector<SweepScenario> &scenarios, const char *outFile,
+ int nThreads, int outputEvery=0);
+
+#endif
@@ -0,0 +1,273 @@
+/*parameter sweeps: many scenarios (D, concs, size of the piece, ...) run
+  in one go instead of one run of the model each, for fitting the soak
+  curves. See readSweepScenarios and runSweep in diffusioncore.h.
+*/
+#include "diffusioncore.h"
+
+#include <map>
+
+using std::cout;
+using std::endl;
+
+//one line of the results
+struct SweepRow {
+ long long step;
+ double time;
+ double waterMoles; //in the acrylic, i.e. all but the two fixed layers
+ double centreConc;
+};
+
+//the acrylic elems: label them once per grid
+static std::vector<long> acrylicElems(int nx, int ny, int nz)
+{
+ std::vector<unsigned char> elemLabel((long)nx*ny*nz);
+ std::vector<long> outerElems, waterElems, acrylic;
+ labelElems(&elemLabel[0], nx, ny, nz, outerElems, waterElems);
+ for (size_t e=0; e<elemLabel.size(); e++) if (elemLabel[e]==kAcrylic) acrylic.push_back(e);
+ return acrylic;
+}
+
+//seconds per step for a scenario, as runDiffusion would pick it
+static double sweepTimestep(const DiffusionConfig &config)
+{
+ return gridTimestep(config, config.dCoeff, config.xTotLen/config.nx, config.yTotLen/config.ny,
+                     config.zTotLen/config.nz, false);
+}
+
+/*runs up to kSweepLanes stencil scenarios with the same grid and n.o.
+  steps, interleaved in one grid. Lanes past the last scenario are copies
+  of lane 0 whose results are thrown away.
+ function name: runStencilBatch
+ param1: all the scenarios
+ param2: which of them are in this batch
+ param3: write every this many steps, 0 for 50 lines
+ param4: results per scenario (output, only the batch's are touched)
+*/
+static void runStencilBatch(const std::vector<SweepScenario> &scenarios,
+ const std::vector<int> &batch, int outputEvery, std::vector<std::vector<SweepRow> > &rows)
+{
+ const int L = kSweepLanes;
+ const DiffusionConfig &first = scenarios[batch[0]].config;
+ const int nx = first.nx, ny = first.ny, nz = first.nz;
+ const long cells = (long)nx*ny*nz;
+ std::vector<unsigned char> elemLabel(cells);
+ std::vector<long> outerElems, waterElems;
+ labelElems(&elemLabel[0], nx, ny, nz, outerElems, waterElems);
+ const std::vector<long> acrylic = acrylicElems(nx, ny, nz);
+
+ double rx[L], ry[L], rz[L], dt[L], elemVol[L];
+ std::vector<double> concCur(cells*L, 0.0), concNext(cells*L, 0.0);
+ for (int l=0; l<L; l++) {
+  const DiffusionConfig &config = scenarios[batch[l<(int)batch.size() ? l : 0]].config;
+  const double xLen = config.xTotLen/nx, yLen = config.yTotLen/ny, zLen = config.zTotLen/nz;
+  dt[l] = sweepTimestep(config);
+  rx[l] = config.dCoeff*dt[l]/(xLen*xLen);
+  ry[l] = config.dCoeff*dt[l]/(yLen*yLen);
+  rz[l] = config.dCoeff*dt[l]/(zLen*zLen);
+  elemVol[l] = xLen*yLen*zLen;
+  const double maxConc = waterLayerConc(config);
+  for (size_t q=0; q<outerElems.size(); q++) {
+   concCur[outerElems[q]*L+l] = concNext[outerElems[q]*L+l] = config.holderConc;
+  }
+  for (size_t q=0; q<waterElems.size(); q++) {
+   concCur[waterElems[q]*L+l] = concNext[waterElems[q]*L+l] = maxConc;
+  }
+ }
+
+ SlabPool pool(1);
+ const long centreElem = nx/2 + (long)nx*(ny/2) + (long)nx*ny*(nz/2);
+ const int totTime = first.totTime;
+ const int every = outputEvery>0 ? outputEvery : (totTime>50 ? totTime/50 : 1);
+ for (int timePassed=1; timePassed<=totTime; timePassed++) {
+  stencilStepLanes(&concCur[0], &concNext[0], nx, ny, nz, rx, ry, rz, pool);
+  concCur.swap(concNext);
+  if (timePassed%every!=0 && timePassed!=totTime) continue;
+  double water[L] = {0};
+  for (size_t q=0; q<acrylic.size(); q++) {
+   const double *c = &concCur[acrylic[q]*L];
+   for (int l=0; l<L; l++) water[l] += c[l];
+  }
+  for (int l=0; l<(int)batch.size(); l++) {
+   SweepRow row = {timePassed, timePassed*dt[l], water[l]*elemVol[l], concCur[centreElem*L+l]};
+   rows[batch[l]].push_back(row);
+  }
+ }
+}
+
+//an ADI scenario on its own
+static void runAdiScenario(const DiffusionConfig &config, int outputEvery,
+ std::vector<SweepRow> &rows)
+{
+ const int nx = config.nx, ny = config.ny, nz = config.nz;
+ const long cells = (long)nx*ny*nz;
+ std::vector<unsigned char> elemLabel(cells);
+ std::vector<long> outerElems, waterElems;
+ labelElems(&elemLabel[0], nx, ny, nz, outerElems, waterElems);
+ const std::vector<long> acrylic = acrylicElems(nx, ny, nz);
+ const double xLen = config.xTotLen/nx, yLen = config.yTotLen/ny, zLen = config.zTotLen/nz;
+ const double dt = sweepTimestep(config), D = config.dCoeff;
+
+ std::vector<double> conc(cells), delta(cells), adiWork(2*(nx+ny+nz));
+ stencilInit(&conc[0], cells, outerElems, waterElems, config.holderConc, waterLayerConc(config));
+ SlabPool pool(1);
+ const long centreElem = nx/2 + (long)nx*(ny/2) + (long)nx*ny*(nz/2);
+ const int totTime = config.totTime;
+ const int every = outputEvery>0 ? outputEvery : (totTime>50 ? totTime/50 : 1);
+ for (int timePassed=1; timePassed<=totTime; timePassed++) {
+  const double theta = timePassed<=2 ? 1 : 0.5;
+  adiStep(&conc[0], &delta[0], nx, ny, nz, D*dt/(xLen*xLen), D*dt/(yLen*yLen),
+          D*dt/(zLen*zLen), theta, &adiWork[0], pool);
+  if (timePassed%every!=0 && timePassed!=totTime) continue;
+  double water = 0;
+  for (size_t q=0; q<acrylic.size(); q++) water += conc[acrylic[q]];
+  SweepRow row = {timePassed, timePassed*dt, water*xLen*yLen*zLen, conc[centreElem]};
+  rows.push_back(row);
+ }
+}
+
+int readSweepScenarios(const char *fileName, std::vector<SweepScenario> &scenarios)
+{
+ FILE *file = fopen(fileName, "r");
+ if (!file) {
+  cout << "can't open sweep table " << fileName << endl;
+  return 1;
+ }
+ std::vector<std::string> columns;
+ char line[4096];
+ int lineNo = 0;
+ while (fgets(line, sizeof(line), file)) {
+  lineNo++;
+  std::vector<std::string> fields;
+  std::string field;
+  for (const char *p=line; ; p++) {
+   if (*p==',' || *p=='\n' || *p=='\r' || *p==0) {
+    //trim spaces round each field
+    size_t b = field.find_first_not_of(" \t"), e = field.find_last_not_of(" \t");
+    fields.push_back(b==std::string::npos ? "" : field.substr(b, e-b+1));
+    field.clear();
+    if (*p!=',') break;
+   }
+   else field += *p;
+  }
+  if (fields.size()==1 && fields[0].empty()) continue; //blank line
+  if (fields[0].size()>0 && fields[0][0]=='#') continue;
+  if (columns.empty()) {
+   columns = fields;
+   continue;
+  }
+
+  SweepScenario scen;
+  char defaultName[32];
+  snprintf(defaultName, sizeof(defaultName), "line%d", lineNo);
+  scen.name = defaultName;
+  scen.config.solverMode = kExplicitStencil;
+  for (size_t q=0; q<fields.size() && q<columns.size(); q++) {
+   const std::string &col = columns[q];
+   const char *val = fields[q].c_str();
+   if (fields[q].empty()) continue;
+   if (col=="name") scen.name = fields[q];
+   else if (col=="mode") {
+    if (fields[q]=="stencil") scen.config.solverMode = kExplicitStencil;
+    else if (fields[q]=="adi") scen.config.solverMode = kImplicitADI;
+    else {
+     cout << fileName << ":" << lineNo << ": mode must be stencil or adi, not " << val << endl;
+     fclose(file);
+     return 1;
+    }
+   }
+   else if (col=="divs") scen.config.nx = scen.config.ny = scen.config.nz = atoi(val);
+   else if (col=="nx") scen.config.nx = atoi(val);
+   else if (col=="ny") scen.config.ny = atoi(val);
+   else if (col=="nz") scen.config.nz = atoi(val);
+   else if (col=="xlen") scen.config.xTotLen = atof(val);
+   else if (col=="ylen") scen.config.yTotLen = atof(val);
+   else if (col=="zlen") scen.config.zTotLen = atof(val);
+   else if (col=="D") scen.config.dCoeff = atof(val);
+   else if (col=="holderConc") scen.config.holderConc = atof(val);
+   else if (col=="maxConc") scen.config.maxConc = atof(val);
+   else if (col=="steps") scen.config.totTime = atoi(val);
+   else if (col=="dt") scen.config.timestep = atof(val);
+   else {
+    cout << fileName << ": no column " << col << endl;
+    fclose(file);
+    return 1;
+   }
+  }
+  scenarios.push_back(scen);
+ }
+ fclose(file);
+ return 0;
+}
+
+int runSweep(const std::vector<SweepScenario> &scenarios, const char *outFile,
+ int nThreads, int outputEvery)
+{
+ for (size_t s=0; s<scenarios.size(); s++) {
+  const DiffusionConfig &config = scenarios[s].config;
+  if (config.nx<5 || config.ny<5 || config.nz<5) {
+   cout << "scenario " << scenarios[s].name << ": need at least 5 divisions along each axis" << endl;
+   return 1;
+  }
+  if (config.solverMode!=kExplicitStencil && config.solverMode!=kImplicitADI) {
+   cout << "scenario " << scenarios[s].name << ": sweeps run stencil or adi only" << endl;
+   return 1;
+  }
+ }
+ FILE *out = fopen(outFile, "w");
+ if (!out) {
+  cout << "can't open " << outFile << endl;
+  return 1;
+ }
+
+ //stencil scenarios sharing a grid and n.o. steps go kSweepLanes to a
+ //batch; each ADI scenario is a batch of its own
+ std::map<std::vector<int>, std::vector<int> > sameGrid;
+ std::vector<std::vector<int> > batches;
+ for (size_t s=0; s<scenarios.size(); s++) {
+  const DiffusionConfig &config = scenarios[s].config;
+  if (config.solverMode==kImplicitADI) {
+   batches.push_back(std::vector<int>(1, (int)s));
+   continue;
+  }
+  std::vector<int> key;
+  key.push_back(config.nx); key.push_back(config.ny); key.push_back(config.nz);
+  key.push_back(config.totTime);
+  std::vector<int> &group = sameGrid[key];
+  group.push_back((int)s);
+  if ((int)group.size()==kSweepLanes) {
+   batches.push_back(group);
+   group.clear();
+  }
+ }
+ for (std::map<std::vector<int>, std::vector<int> >::iterator g=sameGrid.begin(); g!=sameGrid.end(); ++g) {
+  if (!g->second.empty()) batches.push_back(g->second);
+ }
+
+ //biggest batches first, so the threads finish at about the same time
+ std::sort(batches.begin(), batches.end(), [&](const std::vector<int> &a, const std::vector<int> &b) {
+  const DiffusionConfig &ca = scenarios[a[0]].config, &cb = scenarios[b[0]].config;
+  return (double)ca.nx*ca.ny*ca.nz*ca.totTime > (double)cb.nx*cb.ny*cb.nz*cb.totTime;
+ });
+ std::vector<std::vector<SweepRow> > rows(scenarios.size());
+ SlabPool pool(nThreads>0 ? nThreads : (int)std::thread::hardware_concurrency());
+ pool.run((int)batches.size(), [&](int b) {
+  const std::vector<int> &batch = batches[b];
+  if (scenarios[batch[0]].config.solverMode==kImplicitADI) {
+   runAdiScenario(scenarios[batch[0]].config, outputEvery, rows[batch[0]]);
+  }
+  else runStencilBatch(scenarios, batch, outputEvery, rows);
+ });
+
+ fprintf(out, "scenario,step,time,waterMoles,centreConc\n");
+ for (size_t s=0; s<scenarios.size(); s++) {
+  for (size_t q=0; q<rows[s].size(); q++) {
+   const SweepRow &row = rows[s][q];
+   fprintf(out, "%s,%lld,%.10g,%.10g,%.10g\n", scenarios[s].name.c_str(), row.step,
+           row.time, row.waterMoles, row.centreConc);
+  }
+ }
+ fclose(out);
+ cout << "ran " << scenarios.size() << " scenarios in " << batches.size()
+      << " batches, results in " << outFile << endl;
+ return 0;
+}